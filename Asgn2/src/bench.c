@@ -0,0 +1,1160 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include "lwp.h"
+#include "lwpsync.h"
+#include "lwparena.h"
+#include "metrics.h"
+#include "tsc.h"
+#include "lwpsleep.h"
+#include "replay.h"
+#include "lwpsig.h"
+#include "lwpkey.h"
+
+/*
+ * Summary: micro-benchmarks for the LWP library. Each case runs from main
+ * after lwp_start() and prints one line of results.
+ *
+ * usage: bench <case> [n]
+ */
+
+#define SOAK_BATCH 256 /* LWPs alive at once in the soak case */
+#define FANIN_YIELDS 4 /* yields each fan-in worker does first   */
+#define BARRIER_ROUNDS 10
+#define ARENA_ALLOCS 64 /* small allocations per request LWP */
+#define SWAP_ROUNDS 10  /* scheduler switches each way in the swap case */
+#define YIELD_ROUNDS 100000 /* yields per LWP in the yield case */
+#define HANDOFF_ROUNDS 2000 /* items passed producer to consumer in the handoff case */
+#define JOIN_GROUP 4 /* join_order workers that exit in the same round */
+#define SIGNAL_BURST 4 /* most SIGUSR1s the signals case raises at once */
+#define KEY_VALUES 4 /* values each keys worker hands to destructors */
+#define STATS_YIELDS 3 /* yields each stats worker does before it sleeps */
+#define REPLAY_SPREAD 3 /* replay workers yield 0 to REPLAY_SPREAD-1 times */
+#define STATS_SLEEP_NS 2000000ull /* and how long it sleeps, twice as long
+                                     for every other worker */
+
+typedef struct bench_case
+{
+    const char *name;
+    void (*run)(long n);
+    long default_n;
+    const char *desc;
+} bench_case;
+
+/******************** Support Functions *******************/
+/*
+ * Description: thread body that exits right away
+ * Params: unused
+ * Return: 0
+ */
+static int noop(void *unused)
+{
+    return 0;
+}
+
+/*
+ * Description: fan-in worker that yields a few times, then exits
+ * Params: unused
+ * Return: 0
+ */
+static int fanin_worker(void *unused)
+{
+    int i;
+
+    for (i = 0; i < FANIN_YIELDS; i++)
+    {
+        lwp_yield();
+    }
+    return 0;
+}
+
+/*
+ * Description: detached fan-in worker that reports to a wait group
+ * Params: lwp_waitgroup *
+ * Return: 0
+ */
+static int fanin_wg_worker(void *wg)
+{
+    fanin_worker(NULL);
+    lwp_waitgroup_done(wg);
+    return 0;
+}
+
+static lwp_barrier bench_barrier;
+
+/*
+ * Description: worker that meets the others at a barrier every round
+ * Params: unused
+ * Return: 0
+ */
+static int barrier_worker(void *unused)
+{
+    int i;
+
+    for (i = 0; i < BARRIER_ROUNDS; i++)
+    {
+        lwp_barrier_wait(&bench_barrier);
+    }
+    return 0;
+}
+
+/*
+ * Description: request-like worker: a burst of small allocations from its
+ * arena, touched once, all released by lwp_exit()
+ * Params: unused
+ * Return: 0
+ */
+static int arena_worker(void *unused)
+{
+    char *p;
+    int i;
+
+    for (i = 0; i < ARENA_ALLOCS; i++)
+    {
+        p = lwp_arena_alloc(16 + (i % 8) * 16);
+        p[0] = i;
+    }
+    return 0;
+}
+
+/*
+ * Description: the same worker with malloc() and free()
+ * Params: unused
+ * Return: 0
+ */
+static int malloc_worker(void *unused)
+{
+    char *p[ARENA_ALLOCS];
+    int i;
+
+    for (i = 0; i < ARENA_ALLOCS; i++)
+    {
+        p[i] = malloc(16 + (i % 8) * 16);
+        p[i][0] = i;
+    }
+    for (i = 0; i < ARENA_ALLOCS; i++)
+    {
+        free(p[i]);
+    }
+    return 0;
+}
+
+/*
+ * Description: runs n workers, SOAK_BATCH alive at a time
+ * Params: worker and number of workers
+ * Return: elapsed ns
+ */
+static double run_batches(lwpfun worker, long n)
+{
+    double start = now_ns();
+    long created = 0, i;
+
+    while (created < n)
+    {
+        for (i = 0; i < SOAK_BATCH && created < n; i++, created++)
+        {
+            lwp_create(worker, NULL);
+        }
+        for (; i > 0; i--)
+        {
+            lwp_wait(NULL);
+        }
+    }
+    return now_ns() - start;
+}
+
+/******************** Cases *******************/
+/*
+ * Description: creates and reaps n LWPs one batch at a time, checking that
+ * the runtime copes with unbounded creation after lwp_start()
+ * Params: number of LWPs
+ * Return: void
+ */
+static void soak(long n)
+{
+    long created = 0, reaped = 0, i;
+    double start = now_ns();
+    int status;
+
+    while (created < n)
+    {
+        for (i = 0; i < SOAK_BATCH && created < n; i++, created++)
+        {
+            if (lwp_create(noop, NULL) == (tid_t)-1)
+            {
+                fprintf(stderr, "soak: lwp_create failed after %ld\n", created);
+                exit(EXIT_FAILURE);
+            }
+        }
+        while (reaped < created)
+        {
+            if (lwp_wait(&status) == NO_THREAD)
+            {
+                fprintf(stderr, "soak: lost a thread after %ld\n", reaped);
+                exit(EXIT_FAILURE);
+            }
+            reaped++;
+        }
+    }
+    printf("soak: %ld created and reaped, %.1f ns each\n", reaped,
+           (now_ns() - start) / reaped);
+}
+
+/*
+ * Description: spawns n workers and collects them with n lwp_wait() calls
+ * Params: number of workers
+ * Return: void
+ */
+static void fanin_wait(long n)
+{
+    double start = now_ns();
+    long i;
+
+    for (i = 0; i < n; i++)
+    {
+        lwp_create(fanin_worker, NULL);
+    }
+    for (i = 0; i < n; i++)
+    {
+        lwp_wait(NULL);
+    }
+    printf("fanin_wait: %ld workers, %.1f ns per worker\n", n, (now_ns() - start) / n);
+}
+
+/*
+ * Description: spawns n detached workers and collects them with one
+ * lwp_waitgroup_wait()
+ * Params: number of workers
+ * Return: void
+ */
+static void fanin_wg(long n)
+{
+    lwp_attr attr = {0, TRUE};
+    lwp_waitgroup wg;
+    double start = now_ns();
+    long i;
+
+    lwp_waitgroup_init(&wg);
+    lwp_waitgroup_add(&wg, n);
+    for (i = 0; i < n; i++)
+    {
+        lwp_create_ex(fanin_wg_worker, &wg, &attr);
+    }
+    lwp_waitgroup_wait(&wg);
+    printf("fanin_wg: %ld workers, %.1f ns per worker\n", n, (now_ns() - start) / n);
+}
+
+/*
+ * Description: checks that detached workers can't be joined: lwp_join()
+ * on each and lwp_wait_any() over all of them return NO_THREAD at once
+ * instead of sleeping forever, and lwp_wait_any() over the set plus one
+ * joinable worker collects that worker. Exits non-zero on failure.
+ * Params: number of detached workers
+ * Return: void
+ */
+static void join_detached(long n)
+{
+    lwp_attr attr = {0, TRUE};
+    lwp_waitgroup wg;
+    tid_t *tids = malloc((n + 1) * sizeof(tid_t));
+    double start = now_ns();
+    long i, bad = 0;
+
+    if (tids == NULL)
+    {
+        perror("join_detached");
+        exit(EXIT_FAILURE);
+    }
+    lwp_waitgroup_init(&wg);
+    lwp_waitgroup_add(&wg, n);
+    for (i = 0; i < n; i++)
+    {
+        tids[i] = lwp_create_ex(fanin_wg_worker, &wg, &attr);
+    }
+    for (i = 0; i < n; i++)
+    {
+        bad += lwp_join(tids[i], NULL) != NO_THREAD;
+    }
+    bad += lwp_wait_any(tids, n, NULL) != NO_THREAD;
+    tids[n] = lwp_create(fanin_worker, NULL);
+    bad += lwp_wait_any(tids, n + 1, NULL) != tids[n];
+    lwp_waitgroup_wait(&wg);
+    free(tids);
+    if (bad != 0)
+    {
+        fprintf(stderr, "join_detached: %ld joins of detached workers did not fail\n", bad);
+        exit(EXIT_FAILURE);
+    }
+    printf("join_detached: %ld workers, joins refused, %.1f ns per worker\n", n, (now_ns() - start) / n);
+}
+
+/*
+ * Description: worker that yields index / JOIN_GROUP times and exits with
+ * the index, so under round robin worker i is the i-th to exit, and
+ * workers exit JOIN_GROUP to a round
+ * Params: index
+ * Return: the index (mod 256, what an exit status holds)
+ */
+static int ordered_worker(void *arg)
+{
+    long i;
+
+    for (i = 0; i < (long)arg / JOIN_GROUP; i++)
+    {
+        lwp_yield();
+    }
+    return (int)((long)arg & 0xff);
+}
+
+/*
+ * Description: lwp_wait_any() has to hand n workers back in the order they
+ * exit, with their status, whatever order the set lists them in, and
+ * lwp_join() the one it names; exits non-zero otherwise
+ * Params: number of workers
+ * Return: void
+ */
+static void join_order(long n)
+{
+    tid_t *tids = malloc(n * sizeof(tid_t)), got;
+    double start = now_ns();
+    long i, bad = 0;
+    int status;
+
+    if (tids == NULL)
+    {
+        perror("join_order");
+        exit(EXIT_FAILURE);
+    }
+
+    /* the set is listed last to first, so set order is not exit order */
+    for (i = 0; i < n; i++)
+    {
+        tids[n - 1 - i] = lwp_create(ordered_worker, (void *)i);
+    }
+    for (i = 0; i < n; i++)
+    {
+        got = lwp_wait_any(tids, n, &status);
+        if (got != tids[n - 1 - i] || LWPTERMSTAT(status) != (i & 0xff))
+        {
+            fprintf(stderr, "join_order: wait %ld got tid %lu status %d, wanted tid %lu status %ld\n",
+                    i, got, LWPTERMSTAT(status), tids[n - 1 - i], i & 0xff);
+            bad++;
+        }
+    }
+    bad += lwp_wait_any(tids, n, NULL) != NO_THREAD;
+
+    /* join a worker that has not exited yet, then one that already has */
+    for (i = 0; i < n; i++)
+    {
+        tids[i] = lwp_create(ordered_worker, (void *)i);
+    }
+    got = lwp_join(tids[n / 2], &status);
+    bad += got != tids[n / 2] || LWPTERMSTAT(status) != ((n / 2) & 0xff);
+    for (i = 0; i < n; i++)
+    {
+        if (i != n / 2)
+        {
+            got = lwp_join(tids[i], &status);
+            bad += got != tids[i] || LWPTERMSTAT(status) != (i & 0xff);
+        }
+    }
+    bad += lwp_join(tids[0], NULL) != NO_THREAD;
+    free(tids);
+    if (bad != 0)
+    {
+        fprintf(stderr, "join_order: %ld checks failed\n", bad);
+        exit(EXIT_FAILURE);
+    }
+    printf("join_order: %ld workers, reaped in exit order, %.1f ns per worker\n", n, (now_ns() - start) / (2 * n));
+}
+
+static lwp_waitgroup stats_wg;
+
+/*
+ * Description: worker that yields STATS_YIELDS times, while all of them
+ * are runnable, then sleeps and reports to stats_wg, so it is switched out
+ * STATS_YIELDS times voluntarily and once because it blocked
+ * Params: ns to sleep
+ * Return: 0
+ */
+static int stats_worker(void *ns)
+{
+    int i;
+
+    for (i = 0; i < STATS_YIELDS; i++)
+    {
+        lwp_yield();
+    }
+    lwp_sleep_ns((uintptr_t)ns);
+    lwp_waitgroup_done(&stats_wg);
+    return 0;
+}
+
+/*
+ * Description: checks lwp_stats() of n workers, read after they exit and
+ * before they are reaped: every switch in is accounted for, each worker
+ * ran, waited and slept as long as it asked, and its three times fit in
+ * the run. A worker only yields, so one that ran for half of STATS_SLEEP_NS
+ * was charged the process's idle wait. The short sleepers wake while the
+ * long ones still sleep, so the last worker to block and the last short one
+ * to exit each leave the process idle without waking themselves. Exits
+ * non-zero on failure. n is at least 2, so there are both kinds.
+ * Params: number of workers
+ * Return: void
+ */
+static void stats(long n)
+{
+    tid_t *tids;
+    lwp_runstats st;
+    uint64_t start, window, sleep, run = 0;
+    long i, bad = 0;
+
+    n = n < 2 ? 2 : n;
+    tids = malloc(n * sizeof(tid_t));
+    if (tids == NULL)
+    {
+        perror("stats");
+        exit(EXIT_FAILURE);
+    }
+    lwp_stats_enable(TRUE);
+    lwp_waitgroup_init(&stats_wg);
+    lwp_waitgroup_add(&stats_wg, n);
+    start = tsc_now();
+    for (i = 0; i < n; i++)
+    {
+        tids[i] = lwp_create(stats_worker, (void *)(uintptr_t)(STATS_SLEEP_NS << (i % 2)));
+    }
+    lwp_waitgroup_wait(&stats_wg); // each one exits right after done()
+    window = tsc_now() - start;
+
+    for (i = 0; i < n; i++)
+    {
+        if (lwp_stats(tids[i], &st) != 0)
+        {
+            fprintf(stderr, "stats: no stats for tid %lu\n", tids[i]);
+            bad++;
+            continue;
+        }
+        sleep = STATS_SLEEP_NS << (i % 2);
+        if (st.switches != st.voluntary + st.involuntary + 1 || st.voluntary != STATS_YIELDS ||
+            st.involuntary != 1 || st.run_cycles == 0 || st.ready_cycles == 0 ||
+            tsc_to_ns(st.run_cycles) >= STATS_SLEEP_NS / 2 || tsc_to_ns(st.blocked_cycles) < sleep * 9 / 10 ||
+            st.run_cycles + st.ready_cycles + st.blocked_cycles > window)
+        {
+            fprintf(stderr, "stats: tid %lu switches %lu voluntary %lu involuntary %lu cycles run %llu ready %llu "
+                            "blocked %llu of %llu\n",
+                    tids[i], st.switches, st.voluntary, st.involuntary, st.run_cycles, st.ready_cycles,
+                    st.blocked_cycles, (unsigned long long)window);
+            bad++;
+        }
+        run += st.run_cycles;
+    }
+    for (i = 0; i < n; i++)
+    {
+        lwp_wait(NULL);
+    }
+    lwp_stats_enable(FALSE);
+    free(tids);
+    if (bad != 0)
+    {
+        fprintf(stderr, "stats: %ld checks failed\n", bad);
+        exit(EXIT_FAILURE);
+    }
+    printf("stats: %ld workers, %.1f ns run per worker\n", n, (double)tsc_to_ns(run) / n);
+}
+
+static long replay_shift = 0; /* changes how long each replay worker runs */
+
+/*
+ * Description: worker that yields a number of times set by its index and
+ * replay_shift
+ * Params: index
+ * Return: 0
+ */
+static int replay_worker(void *arg)
+{
+    long i;
+
+    for (i = 0; i < ((long)arg + replay_shift) % REPLAY_SPREAD; i++)
+    {
+        lwp_yield();
+    }
+    return 0;
+}
+
+/*
+ * Description: runs n replay workers in a child process, recording the
+ * schedule to a log or replaying it. Children start from the same state,
+ * so they hand out the same tids, which is what the log is keyed by.
+ * Params: log path, TRUE to record, number of workers and replay_shift
+ * (replays of shift 0 must match the recording, others must diverge)
+ * Return: TRUE if the child did what was expected
+ */
+static int replay_child(const char *path, int record, long n, long shift)
+{
+    pid_t pid;
+    long i;
+    int status, ok, null;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("replay");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0)
+    {
+        if (shift != 0 && (null = open("/dev/null", O_WRONLY)) >= 0)
+        {
+            dup2(null, STDERR_FILENO); // the divergence warning is expected
+        }
+        ok = record ? lwp_record_start(path) == 0 : lwp_replay_start(path) > 0;
+        replay_shift = shift;
+        for (i = 0; i < n; i++)
+        {
+            lwp_create(replay_worker, (void *)i);
+        }
+        for (i = 0; i < n; i++)
+        {
+            lwp_wait(NULL);
+        }
+        if (record)
+        {
+            lwp_record_stop();
+        }
+        else
+        {
+            ok = ok && (lwp_replay_diverged() != 0) == (shift != 0);
+        }
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (waitpid(pid, &status, 0) < 0)
+    {
+        perror("replay");
+        exit(EXIT_FAILURE);
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/*
+ * Description: records the schedule of n workers, then checks that a
+ * replay of the same run matches it and a replay of a run where the
+ * workers yield a different number of times reports a divergence. Exits
+ * non-zero on failure.
+ * Params: number of workers
+ * Return: void
+ */
+static void replay(long n)
+{
+    char path[] = "/tmp/lwpreplay.XXXXXX";
+    double start = now_ns();
+    int fd, bad = 0;
+
+    fd = mkstemp(path);
+    if (fd < 0)
+    {
+        perror("replay");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    if (!replay_child(path, TRUE, n, 0))
+    {
+        fprintf(stderr, "replay: recording failed\n");
+        bad++;
+    }
+    else
+    {
+        if (!replay_child(path, FALSE, n, 0))
+        {
+            fprintf(stderr, "replay: replay of the same run diverged\n");
+            bad++;
+        }
+        if (!replay_child(path, FALSE, n, 1))
+        {
+            fprintf(stderr, "replay: replay of a changed run did not diverge\n");
+            bad++;
+        }
+    }
+    unlink(path);
+    if (bad != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    printf("replay: %ld workers, replay matched, change caught, %.1f ns per worker\n", n, (now_ns() - start) / (3 * n));
+}
+
+static long signal_calls = 0; /* signal_count() calls                 */
+static long signal_strays = 0; /* of those, not from the raising thread */
+static tid_t signal_tid = NO_THREAD;
+
+/*
+ * Description: deferred SIGUSR1 callback: counts calls, and the ones not
+ * run by the thread that raised the signal
+ * Params: signal number
+ * Return: void
+ */
+static void signal_count(int sig)
+{
+    signal_calls++;
+    signal_strays += lwp_gettid() != signal_tid;
+}
+
+/*
+ * Description: worker that raises bursts of 1 to SIGNAL_BURST SIGUSR1s,
+ * n in all, checking after each that no callback ran yet and after the
+ * next yield that it ran once per signal
+ * Params: number of signals
+ * Return: number of checks that failed, at most 255
+ */
+static int signal_worker(void *arg)
+{
+    long n = (long)arg, sent = 0, k, i;
+    int bad = 0;
+
+    signal_tid = lwp_gettid();
+    while (sent < n)
+    {
+        k = 1 + sent % SIGNAL_BURST;
+        k = k < n - sent ? k : n - sent;
+        for (i = 0; i < k; i++)
+        {
+            raise(SIGUSR1);
+        }
+        bad += signal_calls != sent;
+        lwp_yield();
+        sent += k;
+        bad += signal_calls != sent;
+    }
+    return bad < 0xff ? bad : 0xff;
+}
+
+/*
+ * Description: checks deferred signal handling: n SIGUSR1s raised by an
+ * LWP run the callback exactly n times, none inside the handler, all at
+ * the raising LWP's next switch and in that LWP. Exits non-zero on
+ * failure.
+ * Params: number of signals
+ * Return: void
+ */
+static void signals(long n)
+{
+    double start = now_ns();
+    int status;
+
+    if (lwp_signal_handle(SIGUSR1, signal_count) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    lwp_create(signal_worker, (void *)n);
+    lwp_wait(&status);
+    lwp_signal_handle(SIGUSR1, NULL);
+    if (LWPTERMSTAT(status) != 0 || signal_calls != n || signal_strays != 0)
+    {
+        fprintf(stderr, "signals: %ld signals, %ld callbacks, %ld outside the raising LWP, %d early or late\n",
+                n, signal_calls, signal_strays, LWPTERMSTAT(status));
+        exit(EXIT_FAILURE);
+    }
+    printf("signals: %ld signals, each handled once at the next switch, %.1f ns per signal\n", n,
+           (now_ns() - start) / n);
+}
+
+static lwp_key_t key_inline, key_over, key_reset, key_null;
+static int *key_calls = NULL; /* KEY_VALUES per worker          */
+static long key_nulls = 0;    /* destructor calls with a NULL value */
+
+/*
+ * Description: key destructor: counts the call in the int the value
+ * points at
+ * Params: value
+ * Return: void
+ */
+static void key_count(void *value)
+{
+    if (value == NULL)
+    {
+        key_nulls++;
+        return;
+    }
+    (*(int *)value)++;
+}
+
+/*
+ * Description: key destructor that sets its key again, from a worker's
+ * value 2 to its value 3, so lwp_key_exit() has to make another pass
+ * Params: value
+ * Return: void
+ */
+static void key_renew(void *value)
+{
+    key_count(value);
+    if (value != NULL && ((int *)value - key_calls) % KEY_VALUES == 2)
+    {
+        lwp_setspecific(key_reset, (int *)value + 1);
+    }
+}
+
+/*
+ * Description: worker that sets an inline key, an overflow key and a key
+ * whose destructor sets it again, and sets then clears one more; checks
+ * the values are still its own after a yield
+ * Params: its KEY_VALUES ints, each to be counted once by a destructor
+ * Return: 0, or 1 if a value changed
+ */
+static int key_worker(void *arg)
+{
+    int *calls = arg;
+
+    lwp_setspecific(key_inline, &calls[0]);
+    lwp_setspecific(key_over, &calls[1]);
+    lwp_setspecific(key_reset, &calls[2]);
+    lwp_setspecific(key_null, &calls[3]);
+    lwp_setspecific(key_null, NULL);
+    lwp_yield();
+    return lwp_getspecific(key_inline) != &calls[0] || lwp_getspecific(key_over) != &calls[1] ||
+           lwp_getspecific(key_reset) != &calls[2] || lwp_getspecific(key_null) != NULL;
+}
+
+/*
+ * Description: checks key destructors: at the exit of each of n workers
+ * every non-NULL value, inline or overflow, is destroyed exactly once,
+ * including one set by a destructor, and a value cleared to NULL is never
+ * passed to one. Exits non-zero on failure.
+ * Params: number of workers
+ * Return: void
+ */
+static void keys(long n)
+{
+    int *calls = key_calls = calloc(n * KEY_VALUES, sizeof(int));
+    double start = now_ns();
+    lwp_key_t pad;
+    long i, bad = 0;
+    int status;
+
+    if (calls == NULL)
+    {
+        perror("keys");
+        exit(EXIT_FAILURE);
+    }
+    if (lwp_key_create(&key_inline, key_count) != 0 || lwp_key_create(&key_null, key_count) != 0 ||
+        lwp_key_create(&key_reset, key_renew) != 0 || key_reset >= LWP_KEYS_INLINE)
+    {
+        fprintf(stderr, "keys: no inline keys left\n");
+        exit(EXIT_FAILURE);
+    }
+    do
+    {
+        if (lwp_key_create(&pad, NULL) != 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+    } while (pad < LWP_KEYS_INLINE);
+    if (lwp_key_create(&key_over, key_count) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        lwp_create(key_worker, &calls[i * KEY_VALUES]);
+    }
+    for (i = 0; i < n; i++)
+    {
+        lwp_wait(&status);
+        bad += LWPTERMSTAT(status) != 0;
+    }
+    for (i = 0; i < n * KEY_VALUES; i++)
+    {
+        if (calls[i] != 1)
+        {
+            fprintf(stderr, "keys: worker %ld value %ld destroyed %d times\n", i / KEY_VALUES, i % KEY_VALUES,
+                    calls[i]);
+            bad++;
+        }
+    }
+    bad += key_nulls != 0;
+    free(calls);
+    key_calls = NULL;
+    if (bad != 0)
+    {
+        fprintf(stderr, "keys: %ld checks failed\n", bad);
+        exit(EXIT_FAILURE);
+    }
+    printf("keys: %ld workers, each value destroyed once, %.1f ns per worker\n", n, (now_ns() - start) / n);
+}
+
+/*
+ * Description: n workers (plus main) cross a barrier BARRIER_ROUNDS times
+ * Params: number of workers
+ * Return: void
+ */
+static void barrier(long n)
+{
+    double start = now_ns();
+    long i;
+
+    lwp_barrier_init(&bench_barrier, n + 1);
+    for (i = 0; i < n; i++)
+    {
+        lwp_create(barrier_worker, NULL);
+    }
+    for (i = 0; i < BARRIER_ROUNDS; i++)
+    {
+        lwp_barrier_wait(&bench_barrier);
+    }
+    printf("barrier: %ld parties, %.1f ns per party per round\n", n + 1,
+           (now_ns() - start) / ((n + 1) * BARRIER_ROUNDS));
+    for (i = 0; i < n; i++)
+    {
+        lwp_wait(NULL);
+    }
+}
+
+/*
+ * Description: creates n LWPs one lwp_create() at a time, then all at once
+ * with lwp_create_many(), timing just the creation; each batch is reaped
+ * before the next one starts. An untimed round of each first warms the
+ * stack pool, malloc and the context pool, so neither timed round pays
+ * for first-touch page faults the other doesn't.
+ * Params: number of LWPs
+ * Return: void
+ */
+static void spawn(long n)
+{
+    double start, one, many;
+    long i;
+
+    run_batches(noop, n);
+    lwp_create_many(noop, NULL, n, NULL);
+    for (i = 0; i < n; i++)
+    {
+        lwp_wait(NULL);
+    }
+
+    start = now_ns();
+    for (i = 0; i < n; i++)
+    {
+        lwp_create(noop, NULL);
+    }
+    one = now_ns() - start;
+    for (i = 0; i < n; i++)
+    {
+        lwp_wait(NULL);
+    }
+
+    start = now_ns();
+    if (lwp_create_many(noop, NULL, n, NULL) != (size_t)n)
+    {
+        fprintf(stderr, "spawn: lwp_create_many came up short\n");
+        exit(EXIT_FAILURE);
+    }
+    many = now_ns() - start;
+    for (i = 0; i < n; i++)
+    {
+        lwp_wait(NULL);
+    }
+    printf("spawn: %ld LWPs, %.1f ns each with lwp_create, %.1f with lwp_create_many (%.1fx)\n",
+           n, one / n, many / n, one / many);
+}
+
+/*
+ * Description: n short-lived workers doing ARENA_ALLOCS small allocations
+ * each, from their arena and then with malloc/free; the spawn and reap
+ * cost is the same in both, so the difference is the allocator
+ * Params: number of workers
+ * Return: void
+ */
+static void arena(long n)
+{
+    double with_arena, with_malloc, with_none;
+
+    with_none = run_batches(noop, n);
+    with_arena = run_batches(arena_worker, n);
+    with_malloc = run_batches(malloc_worker, n);
+    printf("arena: %ld workers x %d allocs, %.1f ns per alloc (arena) vs %.1f (malloc), "
+           "%.0f ns per worker without allocating\n",
+           n, ARENA_ALLOCS, (with_arena - with_none) / (n * ARENA_ALLOCS),
+           (with_malloc - with_none) / (n * ARENA_ALLOCS), with_none / n);
+}
+
+/* round robin copies with and without the batch entry points; they share
+ * rr.c's queue, so switching between them only measures the migration */
+static struct scheduler plain_rr[2] = {{rr_init, rr_shutdown, rr_admit, rr_remove, rr_next, rr_qlen,
+                                        NULL, NULL, NULL, "plain_rr0"},
+                                       {rr_init, rr_shutdown, rr_admit, rr_remove, rr_next, rr_qlen,
+                                        NULL, NULL, NULL, "plain_rr1"}};
+static struct scheduler batch_rr = {rr_init, rr_shutdown, rr_admit, rr_remove, rr_next, rr_qlen,
+                                    rr_admit_many, rr_remove_many, rr_drain, "batch_rr"};
+
+/*
+ * Description: times SWAP_ROUNDS scheduler switches between a and b
+ * Params: the two schedulers
+ * Return: double ns
+ */
+static double swap_rounds(scheduler a, scheduler b)
+{
+    double start = now_ns();
+    int i;
+
+    for (i = 0; i < SWAP_ROUNDS; i++)
+    {
+        lwp_set_scheduler(a);
+        lwp_set_scheduler(b);
+    }
+    return now_ns() - start;
+}
+
+/*
+ * Description: queues n LWPs, then switches the scheduler back and forth
+ * SWAP_ROUNDS times, with drain/admit_many and then with the one thread
+ * at a time fallbacks
+ * Params: number of LWPs
+ * Return: void
+ */
+static void swap(long n)
+{
+    double batched, plain;
+    long i;
+
+    if (lwp_create_many(noop, NULL, n, NULL) != (size_t)n)
+    {
+        fprintf(stderr, "swap: lwp_create_many came up short\n");
+        exit(EXIT_FAILURE);
+    }
+    batched = swap_rounds(&batch_rr, NULL);
+    plain = swap_rounds(&plain_rr[0], &plain_rr[1]);
+    lwp_set_scheduler(NULL);
+    if (lwp_get_scheduler()->qlen() != n + 1)
+    {
+        fprintf(stderr, "swap: %d threads queued after switching, expected %ld\n",
+                lwp_get_scheduler()->qlen(), n + 1);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n; i++)
+    {
+        lwp_wait(NULL);
+    }
+    printf("swap: %ld LWPs, %.1f ns per thread moved with drain/admit_many, %.1f with "
+           "next/remove/admit\n",
+           n, batched / (2 * SWAP_ROUNDS * (n + 1)), plain / (2 * SWAP_ROUNDS * (n + 1)));
+}
+
+/*
+ * Description: yield loop for the yield case
+ * Params: unused
+ * Return: 0
+ */
+static int yielder(void *unused)
+{
+    int i;
+
+    for (i = 0; i < YIELD_ROUNDS; i++)
+    {
+        lwp_yield();
+    }
+    return 0;
+}
+
+/*
+ * Description: times n LWPs yielding YIELD_ROUNDS times each
+ * Params: number of LWPs
+ * Return: double ns per switch
+ */
+static double yield_round(long n)
+{
+    unsigned long switches = lwp_mx->switches;
+    double start = now_ns();
+    long i;
+
+    for (i = 0; i < n; i++)
+    {
+        lwp_create(yielder, NULL);
+    }
+    for (i = 0; i < n; i++)
+    {
+        lwp_wait(NULL);
+    }
+    return (now_ns() - start) / (lwp_mx->switches - switches);
+}
+
+/*
+ * Description: ns per lwp_yield() switch under the built-in round robin,
+ * then under batch_rr, the same code reached through the scheduler table.
+ * They only differ in a -DLWP_STATIC_RR build, where the built-in one is
+ * inlined into the switch path.
+ * Params: number of LWPs
+ * Return: void
+ */
+static void yield(long n)
+{
+    double bound, table;
+
+    yield_round(n); /* warm up stacks and contexts */
+    bound = yield_round(n);
+    lwp_set_scheduler(&batch_rr);
+    table = yield_round(n);
+    lwp_set_scheduler(NULL);
+    printf("yield: %ld LWPs, %.1f ns per switch with round robin, %.1f through the table\n",
+           n, bound, table);
+}
+
+static lwp_latch handoff_latch[HANDOFF_ROUNDS]; /* one per item, count 1 */
+static double handoff_sent[HANDOFF_ROUNDS];      /* when each was handed off */
+static double handoff_delay = 0;                 /* sum of hand-off to pick-up */
+static int handoff_done = FALSE;
+
+/*
+ * Description: background load for the handoff case: yields until the
+ * consumer is done
+ * Params: unused
+ * Return: 0
+ */
+static int spinner(void *unused)
+{
+    while (!handoff_done)
+    {
+        lwp_yield();
+    }
+    return 0;
+}
+
+/*
+ * Description: hands an item to the consumer, then keeps running until
+ * the next switch
+ * Params: unused
+ * Return: 0
+ */
+static int producer(void *unused)
+{
+    int i;
+
+    for (i = 0; i < HANDOFF_ROUNDS; i++)
+    {
+        handoff_sent[i] = now_ns();
+        lwp_latch_count_down(&handoff_latch[i]);
+        lwp_yield();
+    }
+    return 0;
+}
+
+/*
+ * Description: waits for each item and adds up how long it took to start
+ * running after the hand-off
+ * Params: unused
+ * Return: 0
+ */
+static int consumer(void *unused)
+{
+    int i;
+
+    for (i = 0; i < HANDOFF_ROUNDS; i++)
+    {
+        lwp_latch_wait(&handoff_latch[i]);
+        handoff_delay += now_ns() - handoff_sent[i];
+    }
+    handoff_done = TRUE;
+    return 0;
+}
+
+/*
+ * Description: one producer/consumer run among n yielding LWPs
+ * Params: number of background LWPs
+ * Return: double mean ns from hand-off to the consumer running
+ */
+static double handoff_round(long n)
+{
+    long i;
+
+    for (i = 0; i < HANDOFF_ROUNDS; i++)
+    {
+        lwp_latch_init(&handoff_latch[i], 1);
+    }
+    handoff_delay = 0;
+    handoff_done = FALSE;
+    lwp_create(consumer, NULL);
+    for (i = 0; i < n; i++)
+    {
+        lwp_create(spinner, NULL);
+    }
+    lwp_create(producer, NULL);
+    for (i = 0; i < n + 2; i++)
+    {
+        lwp_wait(NULL);
+    }
+    return handoff_delay / HANDOFF_ROUNDS;
+}
+
+/*
+ * Description: producer/consumer hand-off latency with n other LWPs
+ * runnable, with the runnext slot off and on. Off, the woken consumer
+ * waits behind all n; on, it runs at the producer's next switch.
+ * Params: number of background LWPs
+ * Return: void
+ */
+static void handoff(long n)
+{
+    double off, on;
+
+    lwp_runnext_enable(FALSE);
+    off = handoff_round(n);
+    lwp_runnext_enable(TRUE);
+    on = handoff_round(n);
+    lwp_runnext_enable(FALSE);
+    printf("handoff: %ld other LWPs, %.0f ns from hand-off to consumer running, %.0f with runnext\n",
+           n, off, on);
+}
+
+static bench_case cases[] = {
+    {"soak", soak, 1000000, "create and reap n LWPs, SOAK_BATCH at a time"},
+    {"fanin_wait", fanin_wait, 10000, "join n workers with n lwp_wait() calls"},
+    {"fanin_wg", fanin_wg, 10000, "join n detached workers with a wait group"},
+    {"join_detached", join_detached, 1000, "lwp_join/lwp_wait_any on n detached workers must fail"},
+    {"join_order", join_order, 100, "lwp_wait_any must reap n workers in exit order, lwp_join by tid"},
+    {"stats", stats, 100, "lwp_stats of n sleeping workers must add up, idle time left out"},
+    {"replay", replay, 100, "replay of n workers must match, replay of a changed run diverge"},
+    {"signals", signals, 10000, "n SIGUSR1s must each run the deferred callback once, at the next switch"},
+    {"keys", keys, 1000, "key destructors of n workers must each run once per non-NULL value"},
+    {"barrier", barrier, 10000, "n workers cross a barrier BARRIER_ROUNDS times"},
+    {"spawn", spawn, 10000, "create n LWPs with lwp_create, then with lwp_create_many"},
+    {"arena", arena, 100000, "n workers allocate ARENA_ALLOCS blocks, arena vs malloc"},
+    {"swap", swap, 100000, "switch schedulers SWAP_ROUNDS times with n LWPs queued"},
+    {"yield", yield, 4, "n LWPs yield YIELD_ROUNDS times, ns per switch"},
+    {"handoff", handoff, 100, "producer/consumer latency with n LWPs runnable, runnext off/on"},
+};
+
+#define NCASES (sizeof(cases) / sizeof(cases[0]))
+
+int main(int argc, char *argv[])
+{
+    unsigned int i;
+    long n;
+
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "usage: %s <case> [n]\n", argv[0]);
+        for (i = 0; i < NCASES; i++)
+        {
+            fprintf(stderr, "  %-10s %s (n=%ld)\n", cases[i].name, cases[i].desc, cases[i].default_n);
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    lwp_start();
+
+    for (i = 0; i < NCASES; i++)
+    {
+        if (strcmp(argv[1], cases[i].name) == 0)
+        {
+            n = argc == 3 ? atol(argv[2]) : cases[i].default_n;
+            cases[i].run(n);
+            return 0;
+        }
+    }
+    fprintf(stderr, "%s: unknown case %s\n", argv[0], argv[1]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include "dump.h"
+#include "tsc.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <dlfcn.h>
+
+/*
+ * Summary: prints the state of every LWP. A parked LWP's only trace is the
+ * rbp it saved in swap_rfiles(), so its backtrace is the rbp chain walked
+ * from there, bounded by its own stack (lwp_start() records main's) so a
+ * garbage frame pointer ends the walk instead of faulting. The running LWP
+ * is walked from the current frame.
+ */
+
+static const char *reason_names[LWP_BLOCK_REASONS] = LWP_BLOCK_NAMES;
+
+/******************** Support Functions *******************/
+/*
+ * Description: one word for where a thread is
+ * Params: thread t
+ * Return: state name
+ */
+static const char *state_name(thread t)
+{
+    if (t == thread_curr)
+    {
+        return "running";
+    }
+    if (LWPTERMINATED(t->status))
+    {
+        return "exited";
+    }
+    if (t->wait_reason != LWP_BLOCK_NONE)
+    {
+        return "blocked";
+    }
+    return "ready";
+}
+
+/*
+ * Description: prints the rbp chain starting at fp, one frame per line
+ * Params: FILE *out, thread t (for its stack bounds) and frame pointer
+ * Return: void
+ */
+static void backtrace_from(FILE *out, thread t, uintptr_t fp)
+{
+    uintptr_t lo, hi, next_fp;
+    Dl_info info;
+    void *pc;
+    int depth;
+
+    if (t->stack == NULL)
+    {
+        fprintf(out, "    (stack unknown)\n");
+        return;
+    }
+    lo = (uintptr_t)t->stack;
+    hi = lo + t->stacksize;
+
+    for (depth = 0; depth < DUMP_MAX_DEPTH && fp >= lo && fp + 16 <= hi && fp % 8 == 0; depth++)
+    {
+        pc = ((void **)fp)[1]; /* return address above saved rbp */
+        if (pc == NULL)
+        {
+            break; /* bottom frame of an LWP stack */
+        }
+        if (dladdr(pc, &info) && info.dli_sname != NULL)
+        {
+            fprintf(out, "    #%-2d %p %s+0x%lx\n", depth, pc, info.dli_sname,
+                    (unsigned long)((char *)pc - (char *)info.dli_saddr));
+        }
+        else
+        {
+            fprintf(out, "    #%-2d %p\n", depth, pc);
+        }
+        next_fp = ((uintptr_t *)fp)[0];
+        if (next_fp <= fp)
+        {
+            break; /* frames must move toward the top of the stack */
+        }
+        fp = next_fp;
+    }
+}
+
+/*
+ * Description: prints one thread
+ * Params: FILE *out and thread t
+ * Return: void
+ */
+static void dump_thread(FILE *out, thread t)
+{
+    fprintf(out, "lwp %lu: %s", t->tid, state_name(t));
+    if (t->wait_reason != LWP_BLOCK_NONE && t->wait_reason < LWP_BLOCK_REASONS)
+    {
+        fprintf(out, " on %s", reason_names[t->wait_reason]);
+    }
+    if (LWPTERMINATED(t->status))
+    {
+        fprintf(out, " status %d", LWPTERMSTAT(t->status));
+    }
+    if (t->flags & LWP_DETACHED)
+    {
+        fprintf(out, " detached");
+    }
+    fprintf(out, "\n");
+
+    if (lwp_stats_on)
+    {
+        fprintf(out, "  run %lluns ready %lluns blocked %lluns switches %lu (%lu vol, %lu invol)\n",
+                (unsigned long long)tsc_to_ns(t->stats.run_cycles),
+                (unsigned long long)tsc_to_ns(t->stats.ready_cycles),
+                (unsigned long long)tsc_to_ns(t->stats.blocked_cycles),
+                t->stats.switches, t->stats.voluntary, t->stats.involuntary);
+    }
+    if (t->stack != NULL)
+    {
+        fprintf(out, "  stack %p size %zu", (void *)t->stack, t->stacksize);
+        if (t->stack_hwm)
+        {
+            fprintf(out, " used %zu", t->stack_hwm);
+        }
+        fprintf(out, "\n");
+    }
+
+    /* an exited thread's frames are gone */
+    if (!LWPTERMINATED(t->status))
+    {
+        backtrace_from(out, t, t == thread_curr ? (uintptr_t)__builtin_frame_address(0) : t->state.rbp);
+    }
+}
+
+/*
+ * Description: signal handler installed by lwp_dump_install()
+ * Params: signal number
+ * Return: void
+ */
+static void dump_handler(int num)
+{
+    lwp_dump(stderr);
+}
+
+/******************** Main Functions *******************/
+/*
+ * Description: prints every LWP, main first. Safe to call from a signal
+ * handler on a best-effort basis (it uses stdio, so output can interleave
+ * with whatever the interrupted code was printing).
+ * Params: FILE *out
+ * Return: void
+ */
+void lwp_dump(FILE *out)
+{
+    thread t;
+
+    fprintf(out, "---- lwp_dump ----\n");
+    if (main_thread != NULL)
+    {
+        dump_thread(out, main_thread);
+    }
+    for (t = thread_internal; t != NULL; t = t->lib_one)
+    {
+        dump_thread(out, t);
+    }
+    fprintf(out, "---- end lwp_dump ----\n");
+    fflush(out);
+}
+
+/*
+ * Description: makes a signal print lwp_dump(stderr), e.g. SIGQUIT (^\)
+ * Params: signal number
+ * Return: void
+ */
+void lwp_dump_install(int sig)
+{
+    struct sigaction sa;
+
+    sa.sa_handler = dump_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(sig, &sa, NULL) < 0)
+    {
+        perror("lwp_dump_install");
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef DUMPH
+#define DUMPH
+#include <stdio.h>
+#include "lwp.h"
+
+/* live introspection: lwp_dump() prints every LWP (tid, state, what it is
+ * blocked on, run statistics, stack use) and a frame-pointer backtrace
+ * walked from its saved registers, so a hung process can be inspected
+ * without a debugger that knows about LWPs */
+
+#define DUMP_MAX_DEPTH 32 /* frames printed per LWP */
+
+extern void lwp_dump(FILE *out);
+extern void lwp_dump_install(int sig);
+
+#endif
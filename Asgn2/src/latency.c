@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+#include "latency.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+
+/*
+ * Summary: admit-to-run histograms. lwp.c stamps t_ready when a thread is
+ * admitted or yields, and latency_switch() turns the stamp into a delay
+ * when that thread is switched in. Delays are kept in TSC cycles (the
+ * bucket math is shifts and a clz) and converted to ns only when queried.
+ * A thread whose stamp predates lwp_latency_enable() is skipped rather
+ * than charged a bogus delay.
+ */
+
+typedef struct latency_hist
+{
+  unsigned long count;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  unsigned long bucket[LATENCY_BUCKETS];
+} latency_hist;
+
+int lwp_latency_on = FALSE;
+
+static scheduler sched_ids[LATENCY_SCHEDS]; /* slot -> scheduler */
+static latency_hist hists[LATENCY_SCHEDS][LATENCY_PRIOS];
+static int atexit_done = FALSE;
+
+/******************** Support Functions *******************/
+/*
+ * Description: histogram bucket of a value: exact below 2^SUB_BITS, then
+ * 2^SUB_BITS linear steps per power of two
+ * Params: cycles
+ * Return: bucket index
+ */
+static int bucket_of(uint64_t v)
+{
+    int exp;
+
+    if (v < (1u << LATENCY_SUB_BITS))
+    {
+        return v;
+    }
+    exp = 63 - __builtin_clzll(v);
+    return ((exp - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) +
+           ((v >> (exp - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1));
+}
+
+/*
+ * Description: highest value that falls in a bucket
+ * Params: bucket index
+ * Return: cycles
+ */
+static uint64_t bucket_top(int b)
+{
+    int exp, sub;
+
+    if (b < (1 << LATENCY_SUB_BITS))
+    {
+        return b;
+    }
+    exp = (b >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+    sub = b & ((1 << LATENCY_SUB_BITS) - 1);
+    return (((uint64_t)(1 << LATENCY_SUB_BITS) + sub + 1) << (exp - LATENCY_SUB_BITS)) - 1;
+}
+
+/*
+ * Description: finds the histogram slot for a scheduler
+ * Params: scheduler and whether to claim a free slot for it
+ * Return: slot, or -1 if it has none (or the table is full)
+ */
+static int sched_slot(scheduler s, int add)
+{
+    int i;
+
+    for (i = 0; i < LATENCY_SCHEDS; i++)
+    {
+        if (sched_ids[i] == s)
+        {
+            return i;
+        }
+        if (sched_ids[i] == NULL)
+        {
+            if (!add)
+            {
+                return -1;
+            }
+            sched_ids[i] = s;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Description: clamps a priority into the tracked range
+ * Params: int prio
+ * Return: 0..LATENCY_PRIOS-1
+ */
+static int prio_slot(int prio)
+{
+    if (prio < 0)
+    {
+        return 0;
+    }
+    return prio < LATENCY_PRIOS ? prio : LATENCY_PRIOS - 1;
+}
+
+/*
+ * Description: prints the report to stderr when measurement was turned on
+ * from the environment
+ * Params: void
+ * Return: void
+ */
+static void report_at_exit(void)
+{
+    lwp_latency_report(stderr);
+}
+
+/******************** Hooks *******************/
+/*
+ * Description: records the delay of the thread being switched in and stamps
+ * a yielding one as runnable again
+ * Params: outgoing thread (may be NULL), incoming thread and why the
+ * outgoing one is leaving (LWP_SWITCH_*)
+ * Return: void
+ */
+void latency_switch(thread outgoing, thread incoming, int why)
+{
+    uint64_t now = tsc_now(), d;
+    latency_hist *h;
+    int slot;
+
+    if (outgoing != NULL && why == LWP_SWITCH_YIELD)
+    {
+        outgoing->t_ready = now;
+    }
+    if (incoming->t_ready == 0)
+    {
+        return;
+    }
+
+    d = now - incoming->t_ready;
+    incoming->t_ready = 0;
+    slot = sched_slot(lwp_get_scheduler(), TRUE);
+    if (slot < 0)
+    {
+        return;
+    }
+    h = &hists[slot][prio_slot(incoming->prio)];
+    if (h->count == 0 || d < h->min)
+    {
+        h->min = d;
+    }
+    if (d > h->max)
+    {
+        h->max = d;
+    }
+    h->count++;
+    h->total += d;
+    h->bucket[bucket_of(d)]++;
+}
+
+/******************** Main Functions *******************/
+/*
+ * Description: turns measurement on or off. LWP_LATENCY=1 at lwp_start()
+ * turns it on and prints the report at exit.
+ * Params: int on
+ * Return: void
+ */
+void lwp_latency_enable(int on)
+{
+    lwp_latency_on = on;
+    if (on && getenv("LWP_LATENCY") != NULL && !atexit_done)
+    {
+        atexit(report_at_exit);
+        atexit_done = TRUE;
+    }
+}
+
+/*
+ * Description: forgets everything recorded so far
+ * Params: void
+ * Return: void
+ */
+void lwp_latency_reset(void)
+{
+    memset(hists, 0, sizeof(hists));
+}
+
+/*
+ * Description: summarizes the delays seen under one scheduler
+ * Params: scheduler (NULL for the current one), priority (or
+ * LATENCY_ALL_PRIOS) and lwp_latency out
+ * Return: number of delays summarized, 0 if none (out is zeroed)
+ */
+int lwp_latency_query(scheduler s, int prio, lwp_latency *out)
+{
+    latency_hist sum;
+    latency_hist *h;
+    unsigned long seen = 0, rank[4];
+    uint64_t *pct[4];
+    int slot, p, b, k = 0;
+
+    memset(out, 0, sizeof(*out));
+    slot = sched_slot(s != NULL ? s : lwp_get_scheduler(), FALSE);
+    if (slot < 0)
+    {
+        return 0;
+    }
+
+    /* fold the requested priorities together */
+    memset(&sum, 0, sizeof(sum));
+    for (p = 0; p < LATENCY_PRIOS; p++)
+    {
+        if (prio != LATENCY_ALL_PRIOS && p != prio_slot(prio))
+        {
+            continue;
+        }
+        h = &hists[slot][p];
+        if (h->count == 0)
+        {
+            continue;
+        }
+        if (sum.count == 0 || h->min < sum.min)
+        {
+            sum.min = h->min;
+        }
+        if (h->max > sum.max)
+        {
+            sum.max = h->max;
+        }
+        sum.count += h->count;
+        sum.total += h->total;
+        for (b = 0; b < LATENCY_BUCKETS; b++)
+        {
+            sum.bucket[b] += h->bucket[b];
+        }
+    }
+    if (sum.count == 0)
+    {
+        return 0;
+    }
+
+    /* percentiles are the top of the bucket holding that rank */
+    rank[0] = (sum.count * 500 + 999) / 1000;
+    rank[1] = (sum.count * 900 + 999) / 1000;
+    rank[2] = (sum.count * 990 + 999) / 1000;
+    rank[3] = (sum.count * 999 + 999) / 1000;
+    pct[0] = &out->p50_ns;
+    pct[1] = &out->p90_ns;
+    pct[2] = &out->p99_ns;
+    pct[3] = &out->p999_ns;
+    for (b = 0; b < LATENCY_BUCKETS && k < 4; b++)
+    {
+        seen += sum.bucket[b];
+        while (k < 4 && seen >= rank[k])
+        {
+            *pct[k++] = tsc_to_ns(bucket_top(b) < sum.max ? bucket_top(b) : sum.max);
+        }
+    }
+
+    out->count = sum.count;
+    out->min_ns = tsc_to_ns(sum.min);
+    out->max_ns = tsc_to_ns(sum.max);
+    out->mean_ns = tsc_to_ns(sum.total / sum.count);
+    return sum.count;
+}
+
+/*
+ * Description: prints one report line
+ * Params: FILE *out, scheduler name, priority label and summary
+ * Return: void
+ */
+static void report_line(FILE *out, const char *name, const char *prio, const lwp_latency *l)
+{
+    fprintf(out, "%-20s %4s %10lu %8llu %8llu %8llu %8llu %8llu %10llu\n", name, prio, l->count,
+            (unsigned long long)l->mean_ns, (unsigned long long)l->p50_ns,
+            (unsigned long long)l->p90_ns, (unsigned long long)l->p99_ns,
+            (unsigned long long)l->p999_ns, (unsigned long long)l->max_ns);
+}
+
+/*
+ * Description: prints an "all" line per scheduler that saw delays, then a
+ * line per priority that did. Schedulers go by their name field, or by
+ * symbol or address if they have none.
+ * Params: FILE *out
+ * Return: void
+ */
+void lwp_latency_report(FILE *out)
+{
+    lwp_latency l;
+    Dl_info info;
+    char name[64], prio[8];
+    int slot, p;
+
+    fprintf(out, "%-20s %4s %10s %8s %8s %8s %8s %8s %10s\n", "scheduler", "prio",
+            "count", "mean", "p50", "p90", "p99", "p999", "max (ns)");
+    for (slot = 0; slot < LATENCY_SCHEDS && sched_ids[slot] != NULL; slot++)
+    {
+        if (sched_ids[slot]->name != NULL)
+        {
+            snprintf(name, sizeof(name), "%s", sched_ids[slot]->name);
+        }
+        else if (dladdr(sched_ids[slot], &info) && info.dli_sname != NULL)
+        {
+            snprintf(name, sizeof(name), "%s", info.dli_sname);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "%p", (void *)sched_ids[slot]);
+        }
+        if (lwp_latency_query(sched_ids[slot], LATENCY_ALL_PRIOS, &l) == 0)
+        {
+            continue;
+        }
+        report_line(out, name, "all", &l);
+        for (p = 0; p < LATENCY_PRIOS; p++)
+        {
+            if (lwp_latency_query(sched_ids[slot], p, &l) != 0)
+            {
+                snprintf(prio, sizeof(prio), "%d", p);
+                report_line(out, name, prio, &l);
+            }
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef LATENCYH
+#define LATENCYH
+#include <stdio.h>
+#include <stdint.h>
+#include "lwp.h"
+#include "tsc.h"
+
+/* scheduling latency: how long a thread sits runnable (admitted, or
+ * switched out by lwp_yield()) before the scheduler runs it. Delays go into
+ * log-bucketed histograms, one per scheduler and priority, with
+ * LATENCY_SUB_BITS of precision inside every power of two like HdrHistogram */
+
+#define LATENCY_SCHEDS 8      /* distinct schedulers tracked        */
+#define LATENCY_PRIOS 8       /* priorities 0..7 (higher ones clamp) */
+#define LATENCY_SUB_BITS 3    /* 8 sub-buckets per power of two      */
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+#define LATENCY_ALL_PRIOS (-1) /* lwp_latency_query() over every prio */
+
+typedef struct lwp_latency
+{
+  unsigned long count;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  uint64_t mean_ns;
+  uint64_t p50_ns;
+  uint64_t p90_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+} lwp_latency;
+
+extern int lwp_latency_on;
+extern void lwp_latency_enable(int on);
+extern void lwp_latency_reset(void);
+extern int lwp_latency_query(scheduler s, int prio, lwp_latency *out);
+extern void lwp_latency_report(FILE *out);
+
+/* hooks for lwp.c: stamp a thread as it becomes runnable, and measure
+ * the one being switched in */
+#define LATENCY_ADMIT(t)                                                       \
+  do                                                                           \
+  {                                                                            \
+    if (lwp_latency_on)                                                        \
+      (t)->t_ready = tsc_now();                                                \
+  } while (0)
+extern void latency_switch(thread outgoing, thread incoming, int why);
+
+#endif
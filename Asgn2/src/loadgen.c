@@ -0,0 +1,497 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include "lwp.h"
+#include "lwpsync.h"
+#include "lwpsleep.h"
+#include "latency.h"
+#include "tsc.h"
+
+/*
+ * Summary: synthetic load generator. Runs a mix of LWP workloads for a
+ * fixed time and prints one CSV row per workload (throughput and per-op
+ * latency percentiles) plus a "sched" row with the scheduler's own
+ * admit-to-run latency, so runs can be swept over thread counts and
+ * schedulers and compared in a spreadsheet.
+ *
+ * usage: loadgen [-t seconds] [-S stacksize] [-H] kind=count[:param] ...
+ *
+ *   cpu=N:ns      N LWPs that spin ns (default 10000) and then yield
+ *   yield=N:k     N LWPs that yield k times (default 1) per op
+ *   sleep=N:us    N LWPs that sleep us (default 1000) in lwp_sleep_ns()
+ *   chan=N        N/2 sender/receiver pairs passing messages through an
+ *                 unbuffered (rendezvous) channel; N must be even
+ *   spawn=N:k     N LWPs that each create and join k (default 1) children
+ *
+ * Every LWP needs its own stack mapping, so very large counts also need a
+ * small -S and a raised vm.max_map_count.
+ */
+
+#define LOADGEN_SAMPLES 65536 /* op latencies kept per kind (reservoir) */
+
+enum kind
+{
+    KIND_CPU,
+    KIND_YIELD,
+    KIND_SLEEP,
+    KIND_CHAN,
+    KIND_SPAWN,
+    KINDS
+};
+
+typedef struct workload
+{
+    const char *name;
+    long default_param;
+    long count;               /* LWPs                    */
+    long param;               /* kind-specific, see usage */
+    unsigned long ops;
+    unsigned long seen;       /* ops offered to the reservoir */
+    uint64_t *samples;        /* op latencies, ns         */
+    unsigned long nsamples;
+} workload;
+
+typedef struct channel
+{
+    lwp_barrier meet;  /* sender and receiver meet once per message */
+    long slot[2];      /* message of round k is in slot[k % 2]      */
+    unsigned long round;
+} channel;
+
+#define CHAN_CLOSED (-1L)
+
+static workload loads[KINDS] = {
+    {"cpu", 10000},
+    {"yield", 1},
+    {"sleep", 1000},
+    {"chan", 0},
+    {"spawn", 1},
+};
+
+static double deadline; /* now_ns() at which the run ends */
+static int stopping = FALSE;
+static size_t stacksize = 0;
+static lwp_waitgroup running;
+static uint64_t rng = 88172645463325252ull;
+
+/******************** Support Functions *******************/
+/*
+ * Description: xorshift64, good enough for reservoir sampling
+ * Params: void
+ * Return: random 64 bits
+ */
+static uint64_t rand64(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+/*
+ * Description: counts one op and offers its latency to the reservoir
+ * Params: workload and op start time (ns)
+ * Return: TRUE while the run should go on
+ */
+static int op_done(workload *w, double start)
+{
+    double end = now_ns();
+    unsigned long i;
+
+    w->ops++;
+    w->seen++;
+    if (w->nsamples < LOADGEN_SAMPLES)
+    {
+        w->samples[w->nsamples++] = end - start;
+    }
+    else if ((i = rand64() % w->seen) < LOADGEN_SAMPLES)
+    {
+        w->samples[i] = end - start;
+    }
+    if (end >= deadline)
+    {
+        stopping = TRUE;
+    }
+    return !stopping;
+}
+
+/*
+ * Description: qsort comparator for latencies
+ * Params: two uint64_t *
+ * Return: <0, 0, >0
+ */
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Description: value at a percentile of a sorted array
+ * Params: sorted samples, their number and the percentile (0-100)
+ * Return: uint64_t sample
+ */
+static uint64_t percentile(const uint64_t *v, unsigned long n, double pct)
+{
+    unsigned long i = (unsigned long)(pct / 100.0 * n);
+    return v[i < n ? i : n - 1];
+}
+
+/******************** Workers *******************/
+/*
+ * Description: child body for the spawn workload
+ * Params: unused
+ * Return: 0
+ */
+static int noop(void *unused)
+{
+    return 0;
+}
+
+/*
+ * Description: op = spin param ns, then yield
+ * Params: unused
+ * Return: 0
+ */
+static int cpu_worker(void *unused)
+{
+    workload *w = &loads[KIND_CPU];
+    double start;
+
+    do
+    {
+        start = now_ns();
+        while (now_ns() - start < w->param)
+            ;
+        lwp_yield();
+    } while (op_done(w, start));
+    lwp_waitgroup_done(&running);
+    return 0;
+}
+
+/*
+ * Description: op = param yields
+ * Params: unused
+ * Return: 0
+ */
+static int yield_worker(void *unused)
+{
+    workload *w = &loads[KIND_YIELD];
+    double start;
+    long i;
+
+    do
+    {
+        start = now_ns();
+        for (i = 0; i < w->param; i++)
+        {
+            lwp_yield();
+        }
+    } while (op_done(w, start));
+    lwp_waitgroup_done(&running);
+    return 0;
+}
+
+/*
+ * Description: op = sleep param us
+ * Params: unused
+ * Return: 0
+ */
+static int sleep_worker(void *unused)
+{
+    workload *w = &loads[KIND_SLEEP];
+    double start;
+
+    do
+    {
+        start = now_ns();
+        lwp_sleep_ns(w->param * 1000ull);
+    } while (op_done(w, start));
+    lwp_waitgroup_done(&running);
+    return 0;
+}
+
+/*
+ * Description: sends sequence numbers until the run is over, then closes
+ * the channel. Only the send side is timed.
+ * Params: channel *
+ * Return: 0
+ */
+static int chan_sender(void *arg)
+{
+    channel *c = arg;
+    workload *w = &loads[KIND_CHAN];
+    double start;
+    int more;
+
+    do
+    {
+        start = now_ns();
+        c->slot[c->round % 2] = c->round;
+        lwp_barrier_wait(&c->meet);
+        c->round++;
+        more = op_done(w, start);
+    } while (more);
+
+    c->slot[c->round % 2] = CHAN_CLOSED;
+    lwp_barrier_wait(&c->meet);
+    lwp_waitgroup_done(&running);
+    return 0;
+}
+
+/*
+ * Description: receives until the channel is closed
+ * Params: channel *
+ * Return: 0
+ */
+static int chan_receiver(void *arg)
+{
+    channel *c = arg;
+    unsigned long round = 0;
+
+    for (;;)
+    {
+        lwp_barrier_wait(&c->meet);
+        if (c->slot[round % 2] == CHAN_CLOSED)
+        {
+            break;
+        }
+        round++;
+    }
+    lwp_waitgroup_done(&running);
+    return 0;
+}
+
+/*
+ * Description: op = create and join param children
+ * Params: unused
+ * Return: 0
+ */
+static int spawn_worker(void *unused)
+{
+    workload *w = &loads[KIND_SPAWN];
+    lwp_attr attr = {stacksize, FALSE, 0};
+    double start;
+    tid_t child;
+    long i;
+
+    do
+    {
+        start = now_ns();
+        for (i = 0; i < w->param; i++)
+        {
+            child = lwp_create_ex(noop, NULL, &attr);
+            if (child == (tid_t)-1)
+            {
+                fprintf(stderr, "loadgen: spawn failed\n");
+                exit(EXIT_FAILURE);
+            }
+            lwp_join(child, NULL);
+        }
+    } while (op_done(w, start));
+    lwp_waitgroup_done(&running);
+    return 0;
+}
+
+/*
+ * Description: starts one detached LWP, exiting if that fails
+ * Params: entry function and argument
+ * Return: void
+ */
+static void spawn(lwpfun fun, void *arg)
+{
+    lwp_attr attr = {stacksize, TRUE, 0};
+
+    if (lwp_create_ex(fun, arg, &attr) == (tid_t)-1)
+    {
+        fprintf(stderr, "loadgen: lwp_create failed (try a smaller -S or "
+                        "a larger vm.max_map_count)\n");
+        exit(EXIT_FAILURE);
+    }
+    lwp_waitgroup_add(&running, 1);
+}
+
+/*
+ * Description: parses kind=count[:param]
+ * Params: the argument
+ * Return: TRUE if it named a known kind with a usable count
+ */
+static int parse_load(const char *arg)
+{
+    const char *eq = strchr(arg, '=');
+    char *end;
+    int k;
+
+    if (eq == NULL)
+    {
+        return FALSE;
+    }
+    for (k = 0; k < KINDS; k++)
+    {
+        if (strlen(loads[k].name) == (size_t)(eq - arg) && strncmp(arg, loads[k].name, eq - arg) == 0)
+        {
+            loads[k].count = strtol(eq + 1, &end, 10);
+            loads[k].param = *end == ':' ? strtol(end + 1, NULL, 10) : loads[k].default_param;
+            if (k == KIND_CHAN && loads[k].count % 2 != 0)
+            {
+                fprintf(stderr, "loadgen: chan=%ld: channels need an even count (sender/receiver pairs)\n",
+                        loads[k].count);
+                return FALSE;
+            }
+            return loads[k].count > 0;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Description: prints one CSV row
+ * Params: name, LWPs, param, seconds, ops and latency samples (sorted here)
+ * Return: void
+ */
+static void row(const char *name, long count, long param, double secs, unsigned long ops,
+                uint64_t *samples, unsigned long n)
+{
+    uint64_t total = 0;
+    unsigned long i;
+
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+    for (i = 0; i < n; i++)
+    {
+        total += samples[i];
+    }
+    printf("%s,%ld,%ld,%.3f,%lu,%.0f,%llu,%llu,%llu,%llu,%llu\n", name, count, param, secs, ops,
+           ops / secs, (unsigned long long)(n ? total / n : 0),
+           (unsigned long long)(n ? percentile(samples, n, 50) : 0),
+           (unsigned long long)(n ? percentile(samples, n, 99) : 0),
+           (unsigned long long)(n ? percentile(samples, n, 99.9) : 0),
+           (unsigned long long)(n ? samples[n - 1] : 0));
+}
+
+/*
+ * Description: prints the usage message and exits
+ * Params: program name
+ * Return: does not return
+ */
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t seconds] [-S stacksize] [-H] kind=count[:param] ...\n"
+                    "  kinds: cpu=N:ns yield=N:k sleep=N:us chan=N (even) spawn=N:k\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    double secs = 5, start, elapsed;
+    channel *chans = NULL;
+    lwp_latency sl;
+    int header = TRUE, opt, k;
+    long i, lwps = 0;
+
+    while ((opt = getopt(argc, argv, "t:S:H")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            secs = atof(optarg);
+            break;
+        case 'S':
+            stacksize = strtoul(optarg, NULL, 0);
+            break;
+        case 'H':
+            header = FALSE;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+    }
+    for (i = optind; i < argc; i++)
+    {
+        if (!parse_load(argv[i]))
+        {
+            usage(argv[0]);
+        }
+    }
+
+    for (k = 0; k < KINDS; k++)
+    {
+        loads[k].samples = malloc(LOADGEN_SAMPLES * sizeof(uint64_t));
+        if (loads[k].samples == NULL)
+        {
+            perror("loadgen");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    lwp_start();
+    lwp_latency_enable(TRUE);
+    lwp_waitgroup_init(&running);
+
+    for (i = 0; i < loads[KIND_CPU].count; i++)
+    {
+        spawn(cpu_worker, NULL);
+    }
+    for (i = 0; i < loads[KIND_YIELD].count; i++)
+    {
+        spawn(yield_worker, NULL);
+    }
+    for (i = 0; i < loads[KIND_SLEEP].count; i++)
+    {
+        spawn(sleep_worker, NULL);
+    }
+    if (loads[KIND_CHAN].count > 0)
+    {
+        chans = calloc(loads[KIND_CHAN].count / 2, sizeof(channel));
+        for (i = 0; i < loads[KIND_CHAN].count / 2; i++)
+        {
+            lwp_barrier_init(&chans[i].meet, 2);
+            spawn(chan_sender, &chans[i]);
+            spawn(chan_receiver, &chans[i]);
+        }
+    }
+    for (i = 0; i < loads[KIND_SPAWN].count; i++)
+    {
+        spawn(spawn_worker, NULL);
+    }
+
+    /* the clock starts once everyone exists, so creation cost is left out */
+    for (k = 0; k < KINDS; k++)
+    {
+        lwps += loads[k].count;
+    }
+    start = now_ns();
+    deadline = start + secs * 1e9;
+    lwp_waitgroup_wait(&running);
+    elapsed = (now_ns() - start) / 1e9;
+
+    if (header)
+    {
+        printf("kind,lwps,param,seconds,ops,ops_per_sec,mean_ns,p50_ns,p99_ns,p999_ns,max_ns\n");
+    }
+    for (k = 0; k < KINDS; k++)
+    {
+        if (loads[k].count > 0)
+        {
+            row(loads[k].name, loads[k].count, loads[k].param, elapsed, loads[k].ops,
+                loads[k].samples, loads[k].nsamples);
+        }
+    }
+    if (lwp_latency_query(NULL, LATENCY_ALL_PRIOS, &sl) > 0)
+    {
+        printf("sched,%ld,0,%.3f,%lu,%.0f,%llu,%llu,%llu,%llu,%llu\n", lwps, elapsed, sl.count,
+               sl.count / elapsed, (unsigned long long)sl.mean_ns, (unsigned long long)sl.p50_ns,
+               (unsigned long long)sl.p99_ns, (unsigned long long)sl.p999_ns,
+               (unsigned long long)sl.max_ns);
+    }
+
+    free(chans);
+    return 0;
+}
@@ -1,43 +1,801 @@
 #define _GNU_SOURCE
 #include "lwp.h"
+#include "rr.h"
+#include "offload.h"
+#include "lwpsleep.h"
+#include "tsc.h"
+#include "trace.h"
+#include "stackhwm.h"
+#include "prof.h"
+#include "dump.h"
+#include "metrics.h"
+#include "latency.h"
+#include "replay.h"
+#include "lwpsig.h"
+#include "lwpkey.h"
+#include "lwparena.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/resource.h>
 #include <sys/mman.h>
 
 // global variables
-unsigned int tid_cnt = 0; // counter for tid
+unsigned int tid_cnt = 0; // counter for live threads
+static tid_t last_tid = 0; // last tid handed out, never reused
+static unsigned long last_exit_seq = 0; // exit_seq of the latest lwp_exit()
 
 rfile main_ctx; // saves main stack context before thread execution
 
 thread thread_internal = NULL; // head of local double linked list
 thread thread_curr = NULL;     // thread being executed
+thread main_thread = NULL; // context for the caller of lwp_start()
 
-static struct scheduler round_robin = {rr_init, rr_shutdown, rr_admit, rr_remove, rr_next};
+int lwp_stats_on = FALSE; // keep per-thread run statistics
+
+int lwp_runnext_on = FALSE;     // run the last thread lwp_wake() woke at the next switch
+static thread runnext = NULL;   // that thread, still queued in the scheduler as well
+static int runnext_streak = 0;  // switches in a row that went to runnext
+
+static struct scheduler round_robin = {rr_init, rr_shutdown, rr_admit, rr_remove, rr_next, rr_qlen,
+                                       rr_admit_many, rr_remove_many, rr_drain, "round_robin"};
 scheduler sched = &round_robin;
 
+/* scheduler calls on the switch path. With -DLWP_STATIC_RR round robin is
+ * bound at compile time: while it is installed its operations are inlined
+ * from rr.h, and any other scheduler (lwp_set_scheduler(), replay) still
+ * goes through the table. */
+#ifdef LWP_STATIC_RR
+#define SCHED_IS_RR() __builtin_expect(sched == &round_robin, 1)
+#define SCHED_NEXT() (SCHED_IS_RR() ? rr_next_inline() : sched->next())
+#define SCHED_ADMIT(t) (SCHED_IS_RR() ? rr_admit_inline(t) : sched->admit(t))
+#define SCHED_REMOVE(t) (SCHED_IS_RR() ? rr_remove_inline(t) : sched->remove(t))
+#else
+#define SCHED_NEXT() sched->next()
+#define SCHED_ADMIT(t) sched->admit(t)
+#define SCHED_REMOVE(t) sched->remove(t)
+#endif
+
 thread wait_queue_first = NULL;
 thread wait_queue_last = NULL;
 
-thread *terminated_queue;
-int terminated_add_idx;
-int terminated_rmv_idx;
+thread terminated_first = NULL; // exited threads nobody has waited for yet,
+thread terminated_last = NULL;  // oldest first, linked through q_next/q_prev
+int terminated_cnt = 0;
+
+static thread reclaim_pending = NULL; // detached thread to free after the next switch
+
+static unsigned long *stack_pool = NULL; // free default-size stacks, linked through their top word
+static int stack_pool_cnt = 0;
+
+static thread ctx_pool = NULL; // free lwp_create_many() contexts, linked through hash_next
+
+static thread *tid_table = NULL; // tid -> thread buckets, chained through hash_next
+static size_t tid_table_size = 0;
+static size_t tid_table_cnt = 0;
 
 int last_exit_flg = 0;
 
+static void lwp_reclaim(void);
+
 /******************** Support Functions *******************/
 /*
- * Description: wrapper to take in thread function and args for thread function
- * Params: lwpfun fun and void *arg
- * Return: void
+ * Description: wrapper to take in thread function and args for thread function
+ * Params: lwpfun fun and void *arg
+ * Return: void
+ */
+static void lwp_wrap(lwpfun fun, void *arg)
+{
+    int rval;
+    lwp_reclaim();
+    rval = fun(arg);
+    lwp_exit(rval);
+}
+
+/*
+ * Description: adds a thread to the tid table, doubling it when it fills up
+ * Params: thread new
+ * Return: void
+ */
+static void tid_table_insert(thread new)
+{
+    thread *old_table = tid_table;
+    size_t old_size = tid_table_size;
+    thread t, next;
+    size_t i;
+
+    if (tid_table_cnt >= tid_table_size)
+    {
+        tid_table_size = old_size ? old_size * 2 : TID_TABLE_INIT;
+        tid_table = calloc(tid_table_size, sizeof(thread));
+        if (tid_table == NULL)
+        {
+            perror("lwp_create");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < old_size; i++)
+        {
+            for (t = old_table[i]; t != NULL; t = next)
+            {
+                next = t->hash_next;
+                t->hash_next = tid_table[t->tid & (tid_table_size - 1)];
+                tid_table[t->tid & (tid_table_size - 1)] = t;
+            }
+        }
+        free(old_table);
+    }
+
+    new->hash_next = tid_table[new->tid & (tid_table_size - 1)];
+    tid_table[new->tid & (tid_table_size - 1)] = new;
+    tid_table_cnt++;
+}
+
+/*
+ * Description: drops a thread from the tid table
+ * Params: thread victim
+ * Return: void
+ */
+static void tid_table_remove(thread victim)
+{
+    thread *link = &tid_table[victim->tid & (tid_table_size - 1)];
+
+    while (*link != NULL && *link != victim)
+    {
+        link = &(*link)->hash_next;
+    }
+    if (*link != NULL)
+    {
+        *link = victim->hash_next;
+        tid_table_cnt--;
+    }
+}
+
+/*
+ * Description: appends an exited thread to the terminated queue
+ * Params: thread finished
+ * Return: void
+ */
+static void terminated_push(thread finished)
+{
+    finished->q_next = NULL;
+    finished->q_prev = terminated_last;
+    if (terminated_last == NULL)
+    {
+        terminated_first = finished;
+    }
+    else
+    {
+        terminated_last->q_next = finished;
+    }
+    terminated_last = finished;
+    terminated_cnt++;
+}
+
+/*
+ * Description: whether a thread is in the terminated queue
+ * Params: thread t
+ * Return: TRUE if it is (nobody has claimed it yet)
+ */
+static int terminated_queued(thread t)
+{
+    return t == terminated_first || t->q_prev != NULL;
+}
+
+/*
+ * Description: pulls a specific thread out of the terminated queue
+ * Params: thread victim
+ * Return: TRUE if it was queued (and nobody else has claimed it)
+ */
+static int terminated_take(thread victim)
+{
+    if (!terminated_queued(victim))
+    {
+        return FALSE;
+    }
+
+    if (victim->q_prev != NULL)
+    {
+        victim->q_prev->q_next = victim->q_next;
+    }
+    else
+    {
+        terminated_first = victim->q_next;
+    }
+    if (victim->q_next != NULL)
+    {
+        victim->q_next->q_prev = victim->q_prev;
+    }
+    else
+    {
+        terminated_last = victim->q_prev;
+    }
+    victim->q_next = NULL;
+    victim->q_prev = NULL;
+    terminated_cnt--;
+    return TRUE;
+}
+
+/*
+ * Description: size of a default stack, worked out once from RLIMIT_STACK
+ * Params: void
+ * Return: size_t stack size in bytes (page multiple)
+ */
+static size_t default_stacksize(void)
+{
+    static size_t size = 0;
+    size_t page_size;
+    struct rlimit rlim;
+
+    if (size == 0)
+    {
+        /* set stack size (default to 8MB) */
+        page_size = sysconf(_SC_PAGE_SIZE);
+        if (getrlimit(RLIMIT_STACK, &rlim) == 0 && rlim.rlim_cur != RLIM_INFINITY)
+        {
+            size = ((rlim.rlim_cur + page_size - 1) / page_size) * page_size;
+        }
+        else
+        {
+            size = ((DEFAULT_STACK_SIZE + page_size - 1) / page_size) * page_size;
+        }
+    }
+    return size;
+}
+
+/*
+ * Description: bytes kept below each stack as a guard: a PROT_NONE page
+ * when built with -DLWP_STACK_GUARD, otherwise none. Guards are off by
+ * default because each one splits the mapping, so guarded LWPs run into
+ * vm.max_map_count (65530 by default) at around 32k.
+ * Params: void
+ * Return: size_t guard size
+ */
+static size_t stack_guard(void)
+{
+#ifdef LWP_STACK_GUARD
+    return sysconf(_SC_PAGE_SIZE);
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Description: gets a stack, reusing a pooled default-size one if possible
+ * Params: size_t size (page multiple)
+ * Return: base of the stack, or MAP_FAILED
+ */
+static unsigned long *stack_alloc(size_t size)
+{
+    unsigned long *stack;
+
+    if (size == default_stacksize() && stack_pool != NULL)
+    {
+        stack = stack_pool;
+        stack_pool = (unsigned long *)stack[size / sizeof(unsigned long) - 1];
+        stack_pool_cnt--;
+        lwp_mx->stack_pool = stack_pool_cnt;
+        return stack;
+    }
+
+    /* allocate memory for the stack (mmap returns addr to new allocated stack) */
+    stack = mmap(NULL, stack_guard() + size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED || stack_guard() == 0)
+    {
+        return stack;
+    }
+    mprotect(stack, stack_guard(), PROT_NONE);
+    return (unsigned long *)((char *)stack + stack_guard());
+}
+
+/*
+ * Description: returns a stack to the pool, or unmaps it if the pool is full
+ * Params: base and size of the stack
+ * Return: void
+ */
+static void stack_free(unsigned long *stack, size_t size)
+{
+    if (size == default_stacksize() && stack_pool_cnt < STACK_POOL_MAX)
+    {
+        /* next user's high-water mark must not include our pages */
+        if (lwp_stackcheck_on)
+        {
+            madvise(stack, size, MADV_DONTNEED);
+        }
+
+        /* link lives in the top word, which every thread touches anyway */
+        stack[size / sizeof(unsigned long) - 1] = (unsigned long)stack_pool;
+        stack_pool = stack;
+        stack_pool_cnt++;
+        lwp_mx->stack_pool = stack_pool_cnt;
+        return;
+    }
+
+    /* clean up allocated stack for specific thread */
+    if (munmap((char *)stack - stack_guard(), stack_guard() + size) == -1)
+    {
+        perror("munmap");
+    }
+}
+
+/*
+ * Description: unlinks a terminated thread and frees its stack and context.
+ * Must not be called on the stack being freed.
+ * Params: thread victim
+ * Return: void
+ */
+static void lwp_release(thread victim)
+{
+    /* unlink from local doubly linked list and tid table */
+    if (victim->left != NULL)
+    {
+        victim->left->right = victim->right;
+    }
+    else
+    {
+        thread_internal = victim->right;
+    }
+    if (victim->right != NULL)
+    {
+        victim->right->left = victim->left;
+    }
+    tid_table_remove(victim);
+
+    stack_free(victim->stack, victim->stacksize);
+    free(victim->specific_more);
+
+    /* clean up thread (slab contexts can't be freed one by one) */
+    if (victim->flags & LWP_SLAB)
+    {
+        victim->hash_next = ctx_pool;
+        ctx_pool = victim;
+    }
+    else
+    {
+        free(victim);
+    }
+    lwp_mx->live--;
+}
+
+/*
+ * Description: frees a terminated thread's stack and context
+ * Params: thread victim and int status (exit status copied out if not NULL)
+ * Return: tid of the victim
+ */
+static tid_t lwp_reap(thread victim, int *status)
+{
+    tid_t tid = victim->tid;
+
+    /* update exit status */
+    if (status != NULL)
+    {
+        *status = victim->status;
+    }
+    TRACE(TRACE_WAIT, 0, thread_curr ? thread_curr->tid : NO_THREAD, tid);
+
+    lwp_release(victim);
+    tid_cnt--;
+    lwp_mx->reaps++;
+
+    if (tid_cnt == 0 && terminated_cnt == 0)
+    {
+        last_exit_flg = 1;
+    }
+    return tid;
+}
+
+/*
+ * Description: frees a detached thread that exited just before the switch
+ * that got us here (it could not free the stack it was running on)
+ * Params: void
+ * Return: void
+ */
+static void lwp_reclaim(void)
+{
+    if (reclaim_pending != NULL)
+    {
+        lwp_release(reclaim_pending);
+        reclaim_pending = NULL;
+    }
+}
+
+/*
+ * Description: ends the running slice of a thread that is leaving the
+ * scheduler. Done on entry to lwp_dispatch(), before any idle wait, which
+ * is not its run time, and before a wake, which would count the slice as
+ * blocked.
+ * Params: thread going out
+ * Return: void
+ */
+static void stats_leave(thread outgoing)
+{
+    uint64_t now = tsc_now();
+
+    outgoing->stats.run_cycles += now - outgoing->t_mark;
+    outgoing->t_mark = now;
+}
+
+/*
+ * Description: charges the time since the last switch to a yielding
+ * thread going out (a blocking or exiting one was charged by stats_leave())
+ * and the time it spent runnable to the thread coming in
+ * Params: outgoing thread (may be NULL), incoming thread and why the
+ * outgoing one is leaving (LWP_SWITCH_*)
+ * Return: void
+ */
+static void stats_switch(thread outgoing, thread incoming, int why)
+{
+    uint64_t now = tsc_now();
+
+    if (outgoing != NULL)
+    {
+        if (why == LWP_SWITCH_YIELD)
+        {
+            outgoing->stats.run_cycles += now - outgoing->t_mark;
+            outgoing->t_mark = now;
+            outgoing->stats.voluntary++;
+        }
+        else if (why == LWP_SWITCH_BLOCK)
+        {
+            outgoing->stats.involuntary++;
+        }
+    }
+
+    incoming->stats.switches++;
+    incoming->stats.ready_cycles += now - incoming->t_mark;
+    incoming->t_mark = now;
+}
+
+/*
+ * Description: records where the process stack is, so main can be
+ * unwound like any LWP (it is never unmapped; main is never reaped)
+ * Params: thread main
+ * Return: void
+ */
+static void main_stack(thread main)
+{
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+
+    if (pthread_getattr_np(pthread_self(), &attr) == 0)
+    {
+        if (pthread_attr_getstack(&attr, &addr, &size) == 0)
+        {
+            main->stack = addr;
+            main->stacksize = size;
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+/*
+ * Description: lays out a new thread's stack so that the first switch to
+ * it enters lwp_wrap(function, argument)
+ * Params: thread with stack and stacksize set, function and argument
+ * Return: void
+ */
+static void stack_prime(thread t, lwpfun function, void *argument)
+{
+    unsigned long *stack_ptr = t->stack + (t->stacksize / sizeof(unsigned long)); // bottom of stack
+
+    if ((uintptr_t)stack_ptr % 16 != 0)
+    {
+        stack_ptr = (unsigned long *)((uintptr_t)stack_ptr - ((uintptr_t)stack_ptr % 16)); // ensure 16-byte alignment
+    }
+    stack_ptr--;                          // pad so lwp_wrap starts with rsp % 16 == 8 like any call
+    stack_ptr--;
+    *stack_ptr = (unsigned long)lwp_wrap; // decrem by 1 moves 8 bytes
+    stack_ptr--;                          // set addr of curr sp in stack ?
+
+    /* set up context registers */
+    t->state.rbp = (unsigned long)stack_ptr;
+    t->state.rsp = (unsigned long)stack_ptr;
+    t->state.rdi = (unsigned long)function;
+    t->state.rsi = (unsigned long)argument;
+    t->fun = function;
+}
+
+/*
+ * Description: carves default-size stacks out of one mapping, each laid
+ * out like a stack_alloc() one (guard below, if any), so they are freed
+ * or pooled one at a time like any other. Without guards they sit back
+ * to back, and freeing neighbours lets the kernel merge the holes again.
+ * Params: array to fill and how many
+ * Return: number of stacks carved (0 if the mapping failed)
+ */
+static size_t stack_carve(unsigned long **out, size_t n)
+{
+    size_t size = default_stacksize(), guard = stack_guard(), i;
+    char *map;
+
+    map = mmap(NULL, n * (guard + size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    for (i = 0; i < n; i++, map += guard + size)
+    {
+        if (guard != 0)
+        {
+            mprotect(map, guard, PROT_NONE);
+        }
+        out[i] = (unsigned long *)(map + guard);
+    }
+    return n;
+}
+
+/*
+ * Description: links new threads into the thread list and tid table and
+ * hands them to the scheduler
+ * Params: threads and how many
+ * Return: void
+ */
+static void lwp_enlist(thread *ts, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        TRACE(TRACE_CREATE, 0, ts[i]->tid, thread_curr ? thread_curr->tid : NO_THREAD);
+        LATENCY_ADMIT(ts[i]);
+
+        ts[i]->right = thread_internal;
+        if (thread_internal != NULL)
+        {
+            thread_internal->left = ts[i];
+        }
+        thread_internal = ts[i];
+        tid_table_insert(ts[i]);
+    }
+    for (i = 0; i < n; i += SCHED_BATCH)
+    {
+        lwp_sched_admit_many(sched, ts + i, n - i < SCHED_BATCH ? n - i : SCHED_BATCH);
+    }
+    lwp_mx->creations += n;
+    lwp_mx->live += n;
+}
+
+/*
+ * Description: picks the next thread from the scheduler and switches to it.
+ * Deferred signal callbacks run first, so they can affect the pick, and
+ * sleepers that are due are woken. If nothing is runnable but LWPs are
+ * parked in lwp_offload() or lwp_sleep_until(), waits in the kernel for the
+ * helper pool to hand one back or the earliest deadline instead of giving
+ * up. With runnext on, a
+ * freshly woken thread goes first, but only LWP_RUNNEXT_MAX switches in a
+ * row: then the scheduler picks, so threads waking each other can't keep
+ * the rest of the queue waiting.
+ * Params: thread former (context to save, NULL if it will never run again)
+ * and why the current thread is giving up the CPU (LWP_SWITCH_*)
+ * Return: void (returns once former is scheduled again)
+ */
+static void lwp_dispatch(thread former, int why)
+{
+    thread outgoing = thread_curr;
+
+    if (lwp_stats_on && outgoing != NULL && why != LWP_SWITCH_YIELD)
+    {
+        stats_leave(outgoing);
+    }
+    LWP_SIG_POLL();
+    OFFLOAD_POLL();
+    SLEEP_POLL();
+    if (runnext != NULL && runnext_streak < LWP_RUNNEXT_MAX)
+    {
+        thread_curr = runnext;
+        runnext_streak++;
+    }
+    else
+    {
+        thread_curr = SCHED_NEXT();
+        runnext_streak = 0;
+    }
+    while (thread_curr == NULL && (offload_pending() || sleep_cnt != 0))
+    {
+        if (sleep_cnt != 0)
+        {
+            sleep_idle(); // kernel sleep until a deadline or an offload completion
+            offload_poll(FALSE);
+        }
+        else
+        {
+            offload_poll(TRUE);
+        }
+        thread_curr = runnext != NULL ? runnext : SCHED_NEXT();
+    }
+    if (thread_curr == runnext)
+    {
+        runnext = NULL;
+    }
+
+    /* if current thread is NULL, return to main proccess */
+    if (thread_curr == NULL)
+    {
+        swap_rfiles(NULL, &main_ctx);
+        return; // should not reach bc stack pointer points somewhere else
+    }
+    RECORD_NEXT(thread_curr);
+
+    /* scheduler picked the caller again, nothing to switch */
+    if (thread_curr == former)
+    {
+        return;
+    }
+
+    if (lwp_stats_on)
+    {
+        stats_switch(outgoing, thread_curr, why);
+    }
+    lwp_mx->switches++;
+    if (lwp_latency_on)
+    {
+        latency_switch(outgoing, thread_curr, why);
+    }
+    if (lwp_metrics_on)
+    {
+        lwp_mx->runnable = sched->qlen ? sched->qlen() : -1;
+    }
+    TRACE(TRACE_SWITCH, why, thread_curr->tid, outgoing ? outgoing->tid : NO_THREAD);
+    swap_rfiles(former ? &former->state : NULL, &thread_curr->state);
+    lwp_reclaim();
+}
+
+/*
+ * Description: takes the current thread off the scheduler and runs another
+ * one until someone hands it back with lwp_wake()
+ * Params: what it is waiting for (LWP_BLOCK_*)
+ * Return: void
+ */
+void lwp_block(int reason)
+{
+    TRACE(TRACE_BLOCK, reason, thread_curr->tid, 0);
+    thread_curr->wait_reason = reason;
+    lwp_mx->blocked[reason]++;
+    SCHED_REMOVE(thread_curr);
+    lwp_dispatch(thread_curr, LWP_SWITCH_BLOCK);
+}
+
+/*
+ * Description: bookkeeping for a thread leaving lwp_block(), everything
+ * but handing it to the scheduler
+ * Params: thread to wake
+ * Return: void
+ */
+static void wake_prep(thread t)
+{
+    uint64_t now;
+
+    if (lwp_stats_on)
+    {
+        now = tsc_now();
+        t->stats.blocked_cycles += now - t->t_mark;
+        t->t_mark = now;
+    }
+    TRACE(TRACE_WAKE, 0, t->tid, thread_curr ? thread_curr->tid : NO_THREAD);
+    lwp_mx->blocked[t->wait_reason]--;
+    t->wait_reason = LWP_BLOCK_NONE;
+    LATENCY_ADMIT(t);
+}
+
+/*
+ * Description: makes a thread parked by lwp_block() runnable again. With
+ * runnext on it also runs at the next switch, while what it was woken
+ * for is still in cache. It is admitted all the same, so the scheduler's
+ * order is untouched and it keeps its own turn; a thread woken later
+ * takes the slot over (LIFO) and the earlier one just waits its turn.
+ * Params: thread to wake
+ * Return: void
+ */
+void lwp_wake(thread t)
+{
+    wake_prep(t);
+    SCHED_ADMIT(t);
+    if (lwp_runnext_on)
+    {
+        runnext = t;
+    }
+}
+
+/*
+ * Description: wakes a whole list of parked threads (linked through q_next)
+ * in list order, admitting them SCHED_BATCH at a time. A list of one is
+ * an lwp_wake(); longer ones don't use runnext, so they run in order.
+ * Params: first thread of the list
+ * Return: void
+ */
+void lwp_wake_all(thread list)
+{
+    thread batch[SCHED_BATCH];
+    int n = 0;
+
+    if (list != NULL && list->q_next == NULL)
+    {
+        lwp_wake(list);
+        return;
+    }
+    while (list != NULL)
+    {
+        batch[n] = list;
+        list = list->q_next;
+        batch[n]->q_next = NULL;
+        wake_prep(batch[n]);
+        if (++n == SCHED_BATCH)
+        {
+            lwp_sched_admit_many(sched, batch, n);
+            n = 0;
+        }
+    }
+    lwp_sched_admit_many(sched, batch, n);
+}
+
+/*
+ * Description: admits threads to a scheduler in order, in one call if it
+ * has admit_many
+ * Params: scheduler, threads and how many
+ * Return: void
+ */
+void lwp_sched_admit_many(scheduler s, thread *threads, int n)
+{
+    int i;
+
+    if (s->admit_many != NULL)
+    {
+        s->admit_many(threads, n);
+        return;
+    }
+    for (i = 0; i < n; i++)
+    {
+        s->admit(threads[i]);
+    }
+}
+
+/*
+ * Description: removes threads from a scheduler, in one call if it has
+ * remove_many
+ * Params: scheduler, threads and how many
+ * Return: void
+ */
+void lwp_sched_remove_many(scheduler s, thread *victims, int n)
+{
+    int i;
+
+    if (s->remove_many != NULL)
+    {
+        s->remove_many(victims, n);
+        return;
+    }
+    for (i = 0; i < n; i++)
+    {
+        s->remove(victims[i]);
+    }
+}
+
+/*
+ * Description: takes up to n threads out of a scheduler in the order it
+ * would run them. Without drain, each one is picked with next() and then
+ * removed, which relies on next() returning a queued thread.
+ * Params: scheduler, array to fill and its size
+ * Return: number of threads taken, 0 once the scheduler is empty
  */
-static void lwp_wrap(lwpfun fun, void *arg)
+int lwp_sched_drain(scheduler s, thread *out, int n)
 {
-    int rval;
-    rval = fun(arg);
-    lwp_exit(rval);
+    thread t;
+    int i;
+
+    if (s->drain != NULL)
+    {
+        return s->drain(out, n);
+    }
+    for (i = 0; i < n && (t = s->next()) != NULL; i++)
+    {
+        s->remove(t);
+        out[i] = t;
+    }
+    return i;
 }
 
 /******************** Main Functions *******************/
@@ -48,8 +806,19 @@ static void lwp_wrap(lwpfun fun, void *arg)
  * Return: tid of newly created thread
  */
 tid_t lwp_create(lwpfun function, void *argument)
+{
+    return lwp_create_ex(function, argument, NULL);
+}
+
+/*
+ * Description: creates a thread with the given attributes
+ * Params: lwpfun function, void *argument and attributes (NULL for defaults)
+ * Return: tid of newly created thread
+ */
+tid_t lwp_create_ex(lwpfun function, void *argument, const lwp_attr *attr)
 {
     thread new_thread;
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
 
     /* init new thread */
     new_thread = (thread)malloc(sizeof(context));
@@ -59,47 +828,49 @@ tid_t lwp_create(lwpfun function, void *argument)
         return (tid_t)-1;
     }
 
-    /* set stack size (default to 8MB) */
-    size_t page_size = sysconf(_SC_PAGE_SIZE);
-    struct rlimit rlim;
-    if (getrlimit(RLIMIT_STACK, &rlim) == 0 && rlim.rlim_cur != RLIM_INFINITY)
+    /* stack size rounded up to whole pages */
+    if (attr != NULL && attr->stacksize != 0)
     {
-        new_thread->stacksize = ((rlim.rlim_cur + page_size - 1) / page_size) * page_size;
+        new_thread->stacksize = ((attr->stacksize + page_size - 1) / page_size) * page_size;
     }
     else
     {
-        new_thread->stacksize = ((DEFAULT_STACK_SIZE + page_size - 1) / page_size) * page_size;
+        new_thread->stacksize = default_stacksize();
     }
 
-    /* allocate memory for the stack (mmap returns addr to new allocated stack) */
-    new_thread->stack = mmap(NULL, new_thread->stacksize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
-    if (!new_thread->stacksize)
+    new_thread->stack = stack_alloc(new_thread->stacksize);
+    if (new_thread->stack == MAP_FAILED)
     {
         perror("lwp_create");
+        free(new_thread);
         return (tid_t)-1;
     }
 
     /* set tid */
-    tid_cnt++;
-    new_thread->tid = tid_cnt;
+    new_thread->tid = ++last_tid;
     new_thread->status = LWP_LIVE;
-
-    /* set addresses in stack */
-    unsigned long *stack_ptr = new_thread->stack + (new_thread->stacksize / sizeof(unsigned long)); // bottom of stack
-    if ((uintptr_t)stack_ptr % 16 != 0)
+    new_thread->flags = 0;
+    if (attr != NULL && attr->detached)
     {
-        stack_ptr = (unsigned long *)((uintptr_t)stack_ptr - ((uintptr_t)stack_ptr % 16)); // ensure 16-byte alignment
+        new_thread->flags |= LWP_DETACHED;
+    }
+    else
+    {
+        tid_cnt++;
     }
-    stack_ptr--;
-    *stack_ptr = (unsigned long)lwp_wrap; // decrem by 1 moves 8 bytes
-    stack_ptr--;                          // set addr of curr sp in stack ?
 
-    /* set up context registers */
-    new_thread->state.rbp = (unsigned long)stack_ptr;
-    new_thread->state.rsp = (unsigned long)stack_ptr;
-    new_thread->state.rdi = (unsigned long)function;
-    new_thread->state.rsi = (unsigned long)argument;
+    /* set addresses in stack and context registers */
+    stack_prime(new_thread, function, argument);
     new_thread->state.fxsave = FPU_INIT;
+    new_thread->stack_hwm = 0;
+    new_thread->wait_reason = LWP_BLOCK_NONE;
+    new_thread->prio = attr != NULL ? attr->prio : 0;
+    new_thread->t_ready = 0;
+    memset(new_thread->specific, 0, sizeof(new_thread->specific));
+    new_thread->specific_more = NULL;
+    new_thread->specific_cap = 0;
+    new_thread->arena = NULL;
+    new_thread->sched_data = NULL;
 
     /* init pointers for internal doubly linked list (will not need linked_list.c)
     and prev, next, etc. are #defines in .h */
@@ -107,23 +878,122 @@ tid_t lwp_create(lwpfun function, void *argument)
     new_thread->next = NULL;
     new_thread->right = NULL;
     new_thread->left = NULL;
+    new_thread->exited = NULL;
+    new_thread->joiner = NULL;
+    new_thread->q_next = NULL;
+    new_thread->q_prev = NULL;
+    memset(&new_thread->stats, 0, sizeof(new_thread->stats));
+    new_thread->stats.tid = new_thread->tid;
+    new_thread->t_mark = lwp_stats_on ? tsc_now() : 0;
 
-    /* schedule new thread */
-    sched->admit(new_thread);
+    /* schedule new thread and put it at the front of the local list */
+    lwp_enlist(&new_thread, 1);
 
-    /* inserting into local doubly linked list */
-    if (thread_internal == NULL)
+    return new_thread->tid;
+}
+
+/*
+ * Description: creates n joinable threads running function, with default
+ * stacks. Contexts come from one allocation (or the context pool), stacks
+ * from the stack pool or a few shared mappings, register state is copied
+ * from one template, and all of them are admitted in one go.
+ * Params: lwpfun function, arguments (args[i] for thread i, or NULL for
+ * all NULL), how many, and where to put the tids (or NULL)
+ * Return: number created; fewer than n only if memory ran out
+ */
+size_t lwp_create_many(lwpfun function, void **args, size_t n, tid_t *tids)
+{
+    static context template;
+    static int template_ready = FALSE;
+    size_t size = default_stacksize(), made = 0, carved = 0, i;
+    unsigned long **stacks;
+    thread *ts, slab = NULL;
+
+    if (n == 0)
     {
-        thread_internal = new_thread;
+        return 0;
     }
-    else
+    if (!template_ready)
     {
-        thread_internal->left = new_thread;
-        new_thread->right = thread_internal;
-        thread_internal = new_thread; // this else body puts new_thread in the front of current head
+        memset(&template, 0, sizeof(template));
+        template.state.fxsave = FPU_INIT;
+        template.status = LWP_LIVE;
+        template.flags = LWP_SLAB;
+        template.stacksize = size;
+        template_ready = TRUE;
     }
 
-    return new_thread->tid;
+    ts = malloc(n * sizeof(thread));
+    stacks = malloc(n * sizeof(unsigned long *));
+    if (ts == NULL || stacks == NULL)
+    {
+        perror("lwp_create_many");
+        free(ts);
+        free(stacks);
+        return 0;
+    }
+
+    /* contexts: pooled ones first, then one slab for the rest */
+    for (i = 0; i < n && ctx_pool != NULL; i++)
+    {
+        ts[i] = ctx_pool;
+        ctx_pool = ctx_pool->hash_next;
+    }
+    if (i < n)
+    {
+        slab = malloc((n - i) * sizeof(context));
+        if (slab == NULL)
+        {
+            perror("lwp_create_many");
+            n = i;
+        }
+        for (; i < n; i++)
+        {
+            ts[i] = slab++;
+        }
+    }
+
+    /* stacks: pooled ones first, then carved in groups */
+    for (i = 0; i < n && stack_pool != NULL; i++)
+    {
+        stacks[i] = stack_alloc(size);
+    }
+    while (i < n)
+    {
+        carved = stack_carve(stacks + i, n - i < STACK_CARVE_MAX ? n - i : STACK_CARVE_MAX);
+        if (carved == 0)
+        {
+            perror("lwp_create_many");
+            break;
+        }
+        i += carved;
+    }
+
+    for (made = 0; made < i; made++)
+    {
+        memcpy(ts[made], &template, sizeof(template));
+        ts[made]->stack = stacks[made];
+        ts[made]->tid = ++last_tid;
+        ts[made]->stats.tid = ts[made]->tid;
+        ts[made]->t_mark = lwp_stats_on ? tsc_now() : 0;
+        stack_prime(ts[made], function, args != NULL ? args[made] : NULL);
+        if (tids != NULL)
+        {
+            tids[made] = ts[made]->tid;
+        }
+    }
+    tid_cnt += made;
+    lwp_enlist(ts, made);
+
+    /* contexts left over when stacks ran out go to the pool */
+    for (i = made; i < n; i++)
+    {
+        ts[i]->hash_next = ctx_pool;
+        ctx_pool = ts[i];
+    }
+    free(stacks);
+    free(ts);
+    return made;
 }
 
 /*
@@ -133,13 +1003,57 @@ tid_t lwp_create(lwpfun function, void *argument)
  */
 void lwp_start(void)
 {
-    /* init wait queue */
-    terminated_queue = malloc(sizeof(thread) * tid_cnt);
+    char *env;
 
     /* init main thread */
-    thread main_thread = (thread)malloc(sizeof(context));
+    main_thread = (thread)calloc(1, sizeof(context));
     main_thread->tid = 0;
     main_thread->state = main_ctx;
+    main_stack(main_thread);
+    if (getenv("LWP_STATS") != NULL)
+    {
+        lwp_stats_enable(TRUE);
+    }
+    if (getenv("LWP_RUNNEXT") != NULL)
+    {
+        lwp_runnext_enable(TRUE);
+    }
+    if (getenv("LWP_STACKCHECK") != NULL)
+    {
+        lwp_stackcheck_enable(TRUE);
+    }
+    if (getenv("LWP_PROF") != NULL)
+    {
+        lwp_prof_start(getenv("LWP_PROF_HZ") ? atoi(getenv("LWP_PROF_HZ")) : PROF_DEFAULT_HZ);
+    }
+    if (getenv("LWP_TRACE") != NULL && !lwp_trace_on)
+    {
+        lwp_trace_start(getenv("LWP_TRACE"));
+    }
+    if (getenv("LWP_METRICS") != NULL && !lwp_metrics_on)
+    {
+        /* LWP_METRICS=path, or any of "", "1" for the default file */
+        env = getenv("LWP_METRICS");
+        lwp_metrics_start(env[0] != '\0' && strcmp(env, "1") != 0 ? env : NULL);
+    }
+    if (getenv("LWP_LATENCY") != NULL)
+    {
+        lwp_latency_enable(TRUE);
+    }
+    if (getenv("LWP_RECORD") != NULL && !lwp_record_on)
+    {
+        lwp_record_start(getenv("LWP_RECORD"));
+    }
+    if (getenv("LWP_REPLAY") != NULL)
+    {
+        lwp_replay_start(getenv("LWP_REPLAY"));
+    }
+    if (getenv("LWP_DUMP") != NULL)
+    {
+        lwp_dump_install(SIGQUIT);
+    }
+    main_thread->t_mark = tsc_now();
+    LATENCY_ADMIT(main_thread);
     sched->admit(main_thread);
 
     /* ensure lwp start called after lwp_create() */
@@ -148,18 +1062,8 @@ void lwp_start(void)
         return;
     }
 
-    /* get thread to execute from sched */
-    thread_curr = sched->next();
-
-    /* if current thread is NULL, return to main proccess */
-    if (thread_curr == NULL)
-    {
-        swap_rfiles(NULL, &main_ctx);
-        return; // should not reach bc stack pointer points somewhere else
-    }
-
-    /* otherwise, save original context and switch to new thread */
-    swap_rfiles(&main_thread->state, &thread_curr->state);
+    /* otherwise, save original context and switch to first thread */
+    lwp_dispatch(main_thread, LWP_SWITCH_YIELD);
 }
 
 /*
@@ -169,26 +1073,14 @@ void lwp_start(void)
  */
 void lwp_yield(void)
 {
-    thread thread_former_curr;
-
     /* move to new thread to execute */
-    thread_former_curr = thread_curr;
-    thread_curr = sched->next();
-
-    /* if current thread is NULL, return to main proccess */
-    if (thread_curr == NULL)
-    {
-        // printf("from yield\n");
-        swap_rfiles(NULL, &main_ctx);
-        return; // should not reach bc stack pointer points somewhere else
-    }
-
-    /* otherwise, save former thread context and switch to new thread */
-    swap_rfiles(&thread_former_curr->state, &thread_curr->state);
+    lwp_dispatch(thread_curr, LWP_SWITCH_YIELD);
 }
 
 /*
- *Description : terminates current thread and goes to next thread
+ *Description : terminates current thread and goes to next thread. A thread
+ * blocked in lwp_join()/lwp_wait_any() on it gets it first, then the oldest
+ * lwp_wait() caller, otherwise it waits in the terminated queue.
  *Params : void
  *Return : void
  */
@@ -201,46 +1093,53 @@ void lwp_exit(int status)
             thread thread_finished_curr;
             thread_finished_curr = thread_curr;
 
-            /* if there is a waiting thread, take the top and store in eixiting threads exitied ptr */
-            if (wait_queue_first != NULL)
+            /* destructors run as this thread and before its arena goes */
+            KEY_EXIT(thread_finished_curr);
+            ARENA_EXIT(thread_finished_curr);
+
+            /* update status of removed thread */
+            thread_finished_curr->status = MKTERMSTAT(LWP_TERM, status);
+            thread_finished_curr->exit_seq = ++last_exit_seq;
+            if (lwp_stackcheck_on)
+            {
+                thread_finished_curr->stack_hwm = stack_measure(thread_finished_curr->stack, thread_finished_curr->stacksize);
+                stack_record(thread_finished_curr->fun, thread_finished_curr->stack_hwm, thread_finished_curr->stacksize);
+            }
+            TRACE(TRACE_EXIT, 0, thread_finished_curr->tid, status);
+            lwp_mx->exits++;
+
+            /* remove thread */
+            SCHED_REMOVE(thread_finished_curr);
+
+            /* hand it to whoever is waiting, or queue it for a later wait */
+            if (thread_finished_curr->flags & LWP_DETACHED)
+            {
+                reclaim_pending = thread_finished_curr; // freed by whoever runs next
+            }
+            else if (thread_finished_curr->joiner != NULL && thread_finished_curr->joiner->exited == NULL)
+            {
+                thread_finished_curr->joiner->exited = thread_finished_curr;
+                lwp_wake(thread_finished_curr->joiner);
+            }
+            else if (wait_queue_first != NULL)
             {
                 thread rmv_assoc_waiting_thread = wait_queue_first;
-                wait_queue_first = wait_queue_first->right;
-                if (wait_queue_first != NULL)
-                {
-                    wait_queue_first->left = NULL;
-                }
-                else
+                wait_queue_first = wait_queue_first->q_next;
+                if (wait_queue_first == NULL)
                 {
                     wait_queue_last = NULL;
                 }
-                // thread_finished_curr->exited = rmv_assoc_waiting_thread;
+                rmv_assoc_waiting_thread->q_next = NULL;
                 rmv_assoc_waiting_thread->exited = thread_finished_curr;
-                sched->admit(rmv_assoc_waiting_thread);
+                lwp_wake(rmv_assoc_waiting_thread);
             }
-
-            /* update status of removed thread */
-            thread_finished_curr->status = MKTERMSTAT(LWP_TERM, status);
-
-            /* pushed thread to remove onto waiting queue */
-            terminated_queue[terminated_add_idx] = thread_finished_curr;
-            terminated_add_idx++;
-
-            /* remove thread */
-            sched->remove(thread_finished_curr);
-
-            /* scehdule new thread */
-            thread_curr = sched->next();
-
-            /* if current thread is NULL, return to main proccess */
-            if (thread_curr == NULL)
+            else
             {
-                swap_rfiles(NULL, &main_ctx);
-                return; // should not reach bc stack pointer points somewhere else
+                terminated_push(thread_finished_curr);
             }
 
-            /* otherwise, save former thread context and switch to new thread */
-            swap_rfiles(NULL, &thread_curr->state);
+            /* scehdule new thread (never returns here) */
+            lwp_dispatch(NULL, LWP_SWITCH_EXIT);
         }
 
         if (last_exit_flg == 1 && thread_curr->tid == 0)
@@ -257,105 +1156,255 @@ void lwp_exit(int status)
  */
 tid_t lwp_wait(int *status)
 {
-    // printf("called wait\n");
-    int terminated_id = NO_THREAD;
+    thread thread_terminated = terminated_first;
 
-    /* if not threads in terminated queue, put current thread into waiting queue */
-    if ((terminated_add_idx - terminated_rmv_idx) == 0)
+    /* take the oldest thread in the terminated queue */
+    if (thread_terminated != NULL)
     {
-        sched->remove(thread_curr); // removed from main sched
+        terminated_take(thread_terminated);
+        return lwp_reap(thread_terminated, status);
+    }
 
-        if (wait_queue_first == NULL && wait_queue_last == NULL)
-        {
-            wait_queue_first = thread_curr;
-            wait_queue_last = thread_curr;
-        }
-        else
-        {
-            wait_queue_last->right = thread_curr;
-            thread_curr->left = wait_queue_last;
-            wait_queue_last = thread_curr;
-        }
+    /* nothing to reap (and no joinable thread left to exit) */
+    if (tid_cnt == 0)
+    {
+        return NO_THREAD;
+    }
 
-        /* context switch to new thread */
-        lwp_yield();
+    /* put current thread into waiting queue */
+    thread_curr->exited = NULL;
+    thread_curr->q_next = NULL;
+    if (wait_queue_first == NULL)
+    {
+        wait_queue_first = thread_curr;
+    }
+    else
+    {
+        wait_queue_last->q_next = thread_curr;
+    }
+    wait_queue_last = thread_curr;
 
-        /* returns here */
-        if (thread_curr->exited != NULL)
-        {
-            /* remove itself from sched */
-            sched->remove(thread_curr);
+    /* context switch to new thread, lwp_exit() wakes us with exited set */
+    lwp_block(LWP_BLOCK_WAIT);
 
-            /* top of terminated queue */
-            thread thread_terminated = thread_curr->exited;
-            terminated_id = thread_terminated->tid;
+    return lwp_reap(thread_curr->exited, status);
+}
 
-            // adjust terminated queue
-            terminated_rmv_idx++;
-            tid_cnt--;
+/*
+ *Description : waits for one specific thread to terminate and cleans it up
+ *Params : tid_t tid and int status
+ *Return : tid_t tid, or NO_THREAD if tid is unknown, is the caller, is
+ * detached (it is freed at exit, nobody gets woken) or already has someone
+ * waiting for it
+ */
+tid_t lwp_join(tid_t tid, int *status)
+{
+    thread target = tid2thread(tid);
 
-            /* clean up allocated stack for specific thread */
-            if (munmap(thread_terminated->stack, thread_terminated->stacksize) == -1)
-            {
-                perror("munmap");
-                return 1;
-            }
+    if (target == NULL || target == thread_curr || (target->flags & LWP_DETACHED))
+    {
+        return NO_THREAD;
+    }
 
-            /* update exit status */
-            if (status != NULL)
-            {
-                *status = thread_terminated->status;
-            }
+    /* already exited: pull it out of the terminated queue */
+    if (LWPTERMINATED(target->status))
+    {
+        return terminated_take(target) ? lwp_reap(target, status) : NO_THREAD;
+    }
+    if (target->joiner != NULL)
+    {
+        return NO_THREAD;
+    }
 
-            /* clean up thread */
-            free(thread_terminated);
+    /* record ourselves on the target so its lwp_exit() wakes us directly */
+    target->joiner = thread_curr;
+    thread_curr->exited = NULL;
+    lwp_block(LWP_BLOCK_JOIN);
 
-            /* clean up allocated wait queue */
-            if (tid_cnt == 0 && (terminated_add_idx - terminated_rmv_idx) == 0)
-            {
-                free(terminated_queue);
-                last_exit_flg = 1;
-            }
-            return terminated_id;
+    return lwp_reap(thread_curr->exited, status);
+}
+
+/*
+ *Description : waits for whichever thread of a set terminates first and
+ * cleans it up. If several have already exited, the first to exit is
+ * taken. Threads of the set that are detached or already have a joiner
+ * are skipped.
+ *Params : tid set, its size and int status
+ *Return : tid_t tid, or NO_THREAD if no thread in the set can be waited on
+ */
+tid_t lwp_wait_any(const tid_t *set, size_t n, int *status)
+{
+    thread target, first = NULL;
+    size_t i;
+    int claimed = 0;
+
+    /* reap the one that exited first, if some have already */
+    for (i = 0; i < n; i++)
+    {
+        target = tid2thread(set[i]);
+        if (target != NULL && LWPTERMINATED(target->status) && terminated_queued(target) &&
+            (first == NULL || target->exit_seq < first->exit_seq))
+        {
+            first = target;
         }
     }
-    else
+    if (first != NULL && terminated_take(first))
     {
-        /* get top of terminated_queue and keep track of indices for wait queue */
-        thread thread_terminated = terminated_queue[terminated_rmv_idx];
+        return lwp_reap(first, status);
+    }
 
-        printf("something in terminate: %d\n", thread_terminated->tid);
+    /* otherwise register on every live one and sleep until the first exits */
+    thread_curr->exited = NULL;
+    for (i = 0; i < n; i++)
+    {
+        target = tid2thread(set[i]);
+        if (target != NULL && target != thread_curr && !LWPTERMINATED(target->status) &&
+            !(target->flags & LWP_DETACHED) && target->joiner == NULL)
+        {
+            target->joiner = thread_curr;
+            claimed++;
+        }
+    }
+    if (claimed == 0)
+    {
+        return NO_THREAD;
+    }
 
-        terminated_id = thread_terminated->tid;
-        terminated_rmv_idx++;
-        tid_cnt--;
+    lwp_block(LWP_BLOCK_JOIN);
 
-        /* clean up allocated stack for specific thread */
-        if (munmap(thread_terminated->stack, thread_terminated->stacksize) == -1)
+    /* let go of the rest of the set */
+    for (i = 0; i < n; i++)
+    {
+        target = tid2thread(set[i]);
+        if (target != NULL && target->joiner == thread_curr)
         {
-            perror("munmap");
-            return 1;
+            target->joiner = NULL;
         }
+    }
+
+    return lwp_reap(thread_curr->exited, status);
+}
+
+/*
+ *Description : marks a thread detached; it is freed as soon as it exits
+ * instead of waiting for lwp_wait()
+ *Params : tid_t tid
+ *Return : 0 on success, -1 if tid is unknown or already being joined
+ */
+int lwp_detach(tid_t tid)
+{
+    thread target = tid2thread(tid);
+
+    if (target == NULL || (target->flags & LWP_DETACHED))
+    {
+        return -1;
+    }
 
-        /* update exit status */
-        if (status != NULL)
+    /* already exited and unclaimed: nobody is on its stack, free it now */
+    if (LWPTERMINATED(target->status))
+    {
+        if (!terminated_take(target))
         {
-            *status = thread_terminated->status;
+            return -1;
         }
+        lwp_reap(target, NULL);
+        return 0;
+    }
+    if (target->joiner != NULL)
+    {
+        return -1;
+    }
 
-        /* clean up thread */
-        free(thread_terminated);
+    target->flags |= LWP_DETACHED;
+    tid_cnt--;
+    return 0;
+}
+
+/*
+ *Description : turns the runnext slot on or off (see lwp_wake())
+ *Params : int on
+ *Return : void
+ */
+void lwp_runnext_enable(int on)
+{
+    lwp_runnext_on = on;
+    runnext = NULL;
+    runnext_streak = 0;
+}
+
+/*
+ *Description : turns per-thread run statistics on or off. Counters keep
+ * their values; the clocks restart so time spent off is not charged.
+ *Params : int on
+ *Return : void
+ */
+void lwp_stats_enable(int on)
+{
+    uint64_t now = tsc_now();
+    thread t;
+
+    for (t = thread_internal; t != NULL; t = t->right)
+    {
+        t->t_mark = now;
+    }
+    if (main_thread != NULL)
+    {
+        main_thread->t_mark = now;
     }
+    lwp_stats_on = on;
+}
+
+/*
+ *Description : copies out the run statistics of one thread (0 for main)
+ *Params : tid_t tid and lwp_runstats out
+ *Return : 0 on success, -1 if tid is unknown
+ */
+int lwp_stats(tid_t tid, lwp_runstats *out)
+{
+    thread t = tid == 0 ? main_thread : tid2thread(tid);
 
-    /* clean up allocated wait queue */
-    printf("%d", terminated_add_idx - terminated_rmv_idx);
-    if (tid_cnt == 0 && (terminated_add_idx - terminated_rmv_idx) == 0)
+    if (t == NULL)
     {
-        free(terminated_queue);
-        printf("I set the flag\n");
-        last_exit_flg = 1;
+        return -1;
+    }
+    *out = t->stats;
+
+    /* include the slice the caller is in the middle of */
+    if (t == thread_curr && lwp_stats_on)
+    {
+        out->run_cycles += tsc_now() - t->t_mark;
+    }
+    return 0;
+}
+
+/*
+ *Description : copies out the run statistics of main and every thread not
+ * yet reaped
+ *Params : lwp_runstats array and its size
+ *Return : number of threads (may exceed max; only max are copied)
+ */
+int lwp_stats_all(lwp_runstats *out, int max)
+{
+    thread t;
+    int cnt = 0;
+
+    if (main_thread != NULL)
+    {
+        if (cnt < max)
+        {
+            lwp_stats(0, &out[cnt]);
+        }
+        cnt++;
+    }
+    for (t = thread_internal; t != NULL; t = t->right)
+    {
+        if (cnt < max)
+        {
+            lwp_stats(t->tid, &out[cnt]);
+        }
+        cnt++;
     }
-    return terminated_id;
+    return cnt;
 }
 
 /*
@@ -384,21 +1433,19 @@ thread tid2thread(tid_t tid)
 {
     thread thread_return;
 
-    thread_return = thread_internal;
+    if (tid_table_size == 0)
+    {
+        return NULL;
+    }
 
-    while (thread_return != NULL)
+    thread_return = tid_table[tid & (tid_table_size - 1)];
+    while (thread_return != NULL && thread_return->tid != tid)
     {
-        if (thread_return->tid == tid)
-        {
-            return thread_return;
-        }
-        else
-        {
-            thread_return = thread_return->right;
-        }
+        thread_return = thread_return->hash_next;
     }
-    return NULL;
+    return thread_return;
 }
+
 /*
  *Description : returns a pointer to current scheduler
  *Params : void
@@ -411,28 +1458,45 @@ scheduler lwp_get_scheduler(void)
 
 /*
  *Description : sets the current scheduler to new_sched
- * and moves all threads to new scheduler
- *Params : scheduler
+ * and moves all threads to new scheduler, in the order the old one would
+ * have run them. The old one is emptied before the new one is initialized,
+ * since the two may share state (and init() may reset it); meanwhile the
+ * threads wait on a list through q_next, which runnable threads don't use.
+ *Params : scheduler (NULL or one without init for round robin)
  *Return : void
  */
 void lwp_set_scheduler(scheduler new_sched)
 {
-    thread thread_move;
+    thread batch[SCHED_BATCH];
+    thread first = NULL, last = NULL;
+    int n, i;
 
     /* default to round robin */
-    if (new_sched->init == NULL)
+    if (new_sched == NULL || new_sched->init == NULL)
     {
         new_sched = &round_robin;
     }
+    if (new_sched == sched)
+    {
+        return;
+    }
 
-    /* initialize new scheduler */
-    new_sched->init();
-
-    /* move each thread from old to new scheduler */
-    while (thread_move = new_sched->next())
+    /* take every thread out of the old scheduler */
+    while ((n = lwp_sched_drain(sched, batch, SCHED_BATCH)) > 0)
     {
-        sched->remove(thread_move);
-        new_sched->admit(thread_move);
+        for (i = 0; i < n; i++)
+        {
+            batch[i]->q_next = NULL;
+            if (last == NULL)
+            {
+                first = batch[i];
+            }
+            else
+            {
+                last->q_next = batch[i];
+            }
+            last = batch[i];
+        }
     }
 
     /* shutdown old scheduler */
@@ -441,5 +1505,18 @@ void lwp_set_scheduler(scheduler new_sched)
         sched->shutdown();
     }
 
+    /* initialize new scheduler and hand it the threads */
+    new_sched->init();
+    while (first != NULL)
+    {
+        for (n = 0; n < SCHED_BATCH && first != NULL; n++)
+        {
+            batch[n] = first;
+            first = first->q_next;
+            batch[n]->q_next = NULL;
+        }
+        lwp_sched_admit_many(new_sched, batch, n);
+    }
+
     sched = new_sched;
 }
\ No newline at end of file
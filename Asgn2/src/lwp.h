@@ -15,6 +15,7 @@
 #define sched_two prev
 
 #define WAIT_QUEUE_SIZE 150
+#define LWP_KEYS_INLINE 8 /* lwpkey.h keys stored in the context itself */
 
 /* context switch registers */
 #if defined(__x86_64)
@@ -47,6 +48,18 @@ registers
 typedef unsigned long tid_t;
 #define NO_THREAD 0 /* an always invalid thread id */
 
+/* per-thread run statistics, kept while lwp_stats_enable(TRUE) */
+typedef struct lwp_runstats
+{
+  tid_t tid;
+  unsigned long long run_cycles;     /* TSC cycles spent running          */
+  unsigned long long ready_cycles;   /* runnable but waiting for the CPU  */
+  unsigned long long blocked_cycles; /* parked in wait/join/sync/offload  */
+  unsigned long switches;            /* times switched in                 */
+  unsigned long voluntary;           /* switched out by lwp_yield()       */
+  unsigned long involuntary;         /* switched out because it blocked   */
+} lwp_runstats;
+
 typedef struct threadinfo_st *thread;
 typedef struct threadinfo_st
 {
@@ -60,8 +73,38 @@ typedef struct threadinfo_st
   thread sched_one;     /* Two more for            */
   thread sched_two;     /* schedulers to use       */
   thread exited;        /* and one for lwp_wait()  */
+  thread joiner;        /* lwp_join()/lwp_wait_any() caller waiting on us */
+  thread q_next;        /* links for the library's wait and               */
+  thread q_prev;        /* terminated queues                              */
+  thread hash_next;     /* tid table chain                                */
+  unsigned int flags;   /* LWP_DETACHED, ...                              */
+  lwp_runstats stats;   /* run statistics                                 */
+  unsigned long long t_mark; /* TSC at the last change of run state       */
+  int (*fun)(void *);   /* entry function                                 */
+  size_t stack_hwm;     /* deepest stack use, measured at exit            */
+  int wait_reason;      /* LWP_BLOCK_* while parked in lwp_block()        */
+  int prio;             /* priority from lwp_attr, for schedulers/metrics */
+  unsigned long long t_ready; /* TSC when last made runnable (latency)     */
+  void *specific[LWP_KEYS_INLINE]; /* lwp_setspecific() values            */
+  void **specific_more; /* values for keys past the inline ones           */
+  size_t specific_cap;  /* entries in specific_more                       */
+  struct lwp_chunk *arena; /* lwp_arena_alloc() chunks, newest first       */
+  void *sched_data;     /* per-thread value for the scheduler's own use   */
+  unsigned long exit_seq; /* order of lwp_exit() calls, for lwp_wait_any() */
 } context;
 
+#define LWP_DETACHED 0x1 /* freed at exit, never reaped by lwp_wait() */
+#define LWP_REPLAY_READY 0x2 /* runnable, as seen by the replay scheduler */
+#define LWP_SLAB 0x4 /* context from a lwp_create_many() slab, pooled not freed */
+
+/* optional attributes for lwp_create_ex() */
+typedef struct lwp_attr
+{
+  size_t stacksize; /* bytes, 0 for the default */
+  int detached;     /* start out detached       */
+  int prio;         /* priority, 0 is the default */
+} lwp_attr;
+
 typedef int (*lwpfun)(void *); /* type for lwp function */
 
 /* Tuple that describes a scheduler */
@@ -73,18 +116,63 @@ typedef struct scheduler
   void (*remove)(thread victim); /* remove a thread from the pool */
   thread (*next)(void);          /* select a thread to schedule   */
   int (*qlen)(void);             /* number of ready threads       */
+  /* optional batch operations, NULL to fall back on the ones above */
+  void (*admit_many)(thread *threads, int n);  /* admit, in order      */
+  void (*remove_many)(thread *victims, int n); /* remove each of them  */
+  int (*drain)(thread *out, int n); /* take out up to n threads in run
+                                       order, returns how many     */
+  const char *name;              /* for reports, NULL if unnamed  */
 } *scheduler;
 
 /* lwp functions */
 extern tid_t lwp_create(lwpfun, void *);
+extern tid_t lwp_create_ex(lwpfun, void *, const lwp_attr *attr);
+extern size_t lwp_create_many(lwpfun, void **args, size_t n, tid_t *tids);
+extern int lwp_detach(tid_t tid);
 extern void lwp_exit(int status);
 extern tid_t lwp_gettid(void);
 extern void lwp_yield(void);
 extern void lwp_start(void);
 extern tid_t lwp_wait(int *);
+extern tid_t lwp_join(tid_t tid, int *status);
+extern tid_t lwp_wait_any(const tid_t *set, size_t n, int *status);
 extern void lwp_set_scheduler(scheduler fun);
 extern scheduler lwp_get_scheduler(void);
 extern thread tid2thread(tid_t tid);
+extern void lwp_stats_enable(int on);
+extern void lwp_runnext_enable(int on);
+extern int lwp_stats(tid_t tid, lwp_runstats *out);
+extern int lwp_stats_all(lwp_runstats *out, int max);
+
+/* runtime internals shared by the library modules */
+#define LWP_SWITCH_YIELD 0 /* why a thread gave up the CPU */
+#define LWP_SWITCH_BLOCK 1
+#define LWP_SWITCH_EXIT 2
+
+/* what a thread parked in lwp_block() is waiting for */
+#define LWP_BLOCK_NONE 0
+#define LWP_BLOCK_WAIT 1
+#define LWP_BLOCK_JOIN 2
+#define LWP_BLOCK_WAITGROUP 3
+#define LWP_BLOCK_BARRIER 4
+#define LWP_BLOCK_LATCH 5
+#define LWP_BLOCK_OFFLOAD 6
+#define LWP_BLOCK_SLEEP 7
+#define LWP_BLOCK_REASONS 8
+#define LWP_BLOCK_NAMES {"-", "wait", "join", "waitgroup", "barrier", "latch", "offload", "sleep"}
+
+extern thread thread_curr;
+extern thread thread_internal;
+extern thread main_thread;
+extern scheduler sched;
+extern int lwp_stats_on;
+extern int lwp_runnext_on;
+extern void lwp_block(int reason);
+extern void lwp_wake(thread t);
+extern void lwp_wake_all(thread list);
+extern void lwp_sched_admit_many(scheduler s, thread *threads, int n);
+extern void lwp_sched_remove_many(scheduler s, thread *victims, int n);
+extern int lwp_sched_drain(scheduler s, thread *out, int n);
 
 /* for lwp_wait */
 #define TERMOFFSET 8
@@ -99,6 +187,11 @@ void swap_rfiles(rfile *old, rfile *new);
 
 /* new defines */
 #define DEFAULT_STACK_SIZE (8 * 1024 * 1024) // 8MB as a default stack size
+#define TID_TABLE_INIT 64                     // initial buckets in the tid table
+#define STACK_POOL_MAX 256                    // default-size stacks kept for reuse
+#define STACK_CARVE_MAX 64                    // stacks per mapping in lwp_create_many()
+#define SCHED_BATCH 64                        // threads per batch scheduler call
+#define LWP_RUNNEXT_MAX 8                     // switches in a row to woken threads
 
 void rr_init(void);
 void rr_shutdown(void);
@@ -106,5 +199,8 @@ void rr_admit(thread new);
 void rr_remove(thread victim);
 thread rr_next(void);
 int rr_qlen(void);
+void rr_admit_many(thread *threads, int n);
+void rr_remove_many(thread *victims, int n);
+int rr_drain(thread *out, int n);
 
 #endif
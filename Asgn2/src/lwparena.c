@@ -0,0 +1,120 @@
+#include "lwparena.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+/*
+ * Summary: chunk management for the per-LWP arenas. Each LWP keeps a list
+ * of chunks, newest first, and only bumps into the newest. A request that
+ * doesn't fit opens a new standard chunk, from the pool when there is one;
+ * a request bigger than a quarter chunk gets a chunk of its own behind the
+ * newest, so it doesn't waste the rest of the current one. At exit the
+ * standard chunks go back to the pool and the rest to free().
+ */
+
+static lwp_chunk *pool = NULL;
+static int pool_cnt = 0;
+
+/******************** Support Functions *******************/
+/*
+ * Description: gets a chunk, from the pool if it is a standard one
+ * Params: size in bytes, header included
+ * Return: empty chunk, NULL if out of memory
+ */
+static lwp_chunk *chunk_get(size_t size)
+{
+    lwp_chunk *c;
+
+    if (size == LWP_ARENA_CHUNK && pool != NULL)
+    {
+        c = pool;
+        pool = c->next;
+        pool_cnt--;
+    }
+    else
+    {
+        c = aligned_alloc(LWP_ARENA_ALIGN, size);
+        if (c == NULL)
+        {
+            return NULL;
+        }
+        c->size = size;
+    }
+    c->used = sizeof(lwp_chunk);
+    c->next = NULL;
+    return c;
+}
+
+/******************** Main Functions *******************/
+/*
+ * Description: lwp_arena_alloc() when the current chunk is full (or the
+ * thread has none yet)
+ * Params: size, already rounded to LWP_ARENA_ALIGN
+ * Return: memory, NULL if out of memory or not in an LWP
+ */
+void *lwp_arena_alloc_slow(size_t size)
+{
+    lwp_chunk *c;
+    thread t = thread_curr;
+
+    if (t == NULL)
+    {
+        return NULL;
+    }
+
+    if (size > (LWP_ARENA_CHUNK - sizeof(lwp_chunk)) / 4)
+    {
+        /* big: its own chunk, kept behind the one being filled */
+        c = chunk_get(sizeof(lwp_chunk) + size);
+        if (c == NULL)
+        {
+            return NULL;
+        }
+        c->used = c->size;
+        if (t->arena != NULL)
+        {
+            c->next = t->arena->next;
+            t->arena->next = c;
+        }
+        else
+        {
+            t->arena = c;
+        }
+        return c + 1;
+    }
+
+    c = chunk_get(LWP_ARENA_CHUNK);
+    if (c == NULL)
+    {
+        return NULL;
+    }
+    c->next = t->arena;
+    t->arena = c;
+    c->used += size;
+    return c + 1;
+}
+
+/*
+ * Description: frees everything a thread allocated from its arena
+ * Params: thread t
+ * Return: void
+ */
+void lwp_arena_release(thread t)
+{
+    lwp_chunk *c, *next;
+
+    for (c = t->arena; c != NULL; c = next)
+    {
+        next = c->next;
+        if (c->size == LWP_ARENA_CHUNK && pool_cnt < LWP_ARENA_POOL_MAX)
+        {
+            c->next = pool;
+            pool = c;
+            pool_cnt++;
+        }
+        else
+        {
+            free(c);
+        }
+    }
+    t->arena = NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef LWPARENAH
+#define LWPARENAH
+#include <stddef.h>
+#include "lwp.h"
+
+/* per-LWP bump allocation: lwp_arena_alloc() carves memory out of chunks
+ * owned by the current LWP, and all of it goes away at once when the LWP
+ * exits. There is no per-object free. Standard chunks are recycled through
+ * a runtime-wide pool, so a short-lived LWP that allocates a little never
+ * reaches malloc. There is no LWP before lwp_start(), so it returns NULL
+ * there. */
+
+#define LWP_ARENA_CHUNK (64 * 1024) /* standard chunk, header included */
+#define LWP_ARENA_ALIGN 16
+#define LWP_ARENA_POOL_MAX 256      /* idle standard chunks kept       */
+
+typedef struct lwp_chunk
+{
+  struct lwp_chunk *next; /* older chunks of the same LWP, or pool link */
+  size_t size;            /* bytes, header included                     */
+  size_t used;            /* bytes handed out, header included          */
+} __attribute__((aligned(LWP_ARENA_ALIGN))) lwp_chunk;
+
+extern void *lwp_arena_alloc_slow(size_t size);
+extern void lwp_arena_release(thread t);
+
+static inline void *lwp_arena_alloc(size_t size)
+{
+  lwp_chunk *c = thread_curr != NULL ? thread_curr->arena : NULL;
+  void *p;
+
+  size = (size + LWP_ARENA_ALIGN - 1) & ~(size_t)(LWP_ARENA_ALIGN - 1);
+  if (c != NULL && size <= c->size - c->used)
+  {
+    p = (char *)c + c->used;
+    c->used += size;
+    return p;
+  }
+  return lwp_arena_alloc_slow(size);
+}
+
+/* lwp_exit() hook */
+#define ARENA_EXIT(t)                                               \
+  do                                                                \
+  {                                                                 \
+    if ((t)->arena != NULL)                                         \
+      lwp_arena_release(t);                                         \
+  } while (0)
+
+#endif
@@ -0,0 +1,152 @@
+#include "lwpkey.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Summary: key bookkeeping and the slow paths of LWP-local storage. Keys
+ * are handed out in order and never reused. The first LWP_KEYS_INLINE are
+ * served inline from lwpkey.h; the rest live in specific_more, indexed by
+ * key - LWP_KEYS_INLINE and doubled whenever a set lands past its end.
+ */
+
+unsigned int lwp_key_dtors = 0;
+
+static lwp_key_dtor key_dtor[LWP_KEYS_MAX];
+static unsigned int key_cnt = 0;
+
+/******************** Support Functions *******************/
+/*
+ * Description: slot of a key in a thread, growing the overflow table if
+ * asked to
+ * Params: thread t, key and whether to grow
+ * Return: pointer to the slot, NULL if there is none (or no memory)
+ */
+static void **key_slot(thread t, lwp_key_t key, int grow)
+{
+    size_t i, cap;
+    void **more;
+
+    if (key < LWP_KEYS_INLINE)
+    {
+        return &t->specific[key];
+    }
+    i = key - LWP_KEYS_INLINE;
+    if (i >= t->specific_cap)
+    {
+        if (!grow)
+        {
+            return NULL;
+        }
+        cap = t->specific_cap ? t->specific_cap : LWP_KEYS_INLINE;
+        while (cap <= i)
+        {
+            cap *= 2;
+        }
+        more = realloc(t->specific_more, cap * sizeof(void *));
+        if (more == NULL)
+        {
+            return NULL;
+        }
+        memset(more + t->specific_cap, 0, (cap - t->specific_cap) * sizeof(void *));
+        t->specific_more = more;
+        t->specific_cap = cap;
+    }
+    return &t->specific_more[i];
+}
+
+/******************** Main Functions *******************/
+/*
+ * Description: makes a new key, NULL in every thread
+ * Params: key out and destructor run on non-NULL values at exit (or NULL)
+ * Return: 0 on success, -1 if all LWP_KEYS_MAX keys are taken
+ */
+int lwp_key_create(lwp_key_t *key, lwp_key_dtor dtor)
+{
+    if (key_cnt == LWP_KEYS_MAX)
+    {
+        fprintf(stderr, "lwp_key_create: out of keys\n");
+        return -1;
+    }
+    key_dtor[key_cnt] = dtor;
+    if (dtor != NULL)
+    {
+        lwp_key_dtors++;
+    }
+    *key = key_cnt++;
+    return 0;
+}
+
+/*
+ * Description: lwp_getspecific() for overflow keys and outside of any LWP
+ * Params: key
+ * Return: the current thread's value, NULL if never set
+ */
+void *lwp_getspecific_slow(lwp_key_t key)
+{
+    void **slot;
+
+    if (thread_curr == NULL || key >= key_cnt)
+    {
+        return NULL;
+    }
+    slot = key_slot(thread_curr, key, FALSE);
+    return slot != NULL ? *slot : NULL;
+}
+
+/*
+ * Description: lwp_setspecific() for overflow keys and outside of any LWP
+ * Params: key and value
+ * Return: 0 on success, -1 for a bad key, no LWP or no memory
+ */
+int lwp_setspecific_slow(lwp_key_t key, const void *value)
+{
+    void **slot;
+
+    if (thread_curr == NULL || key >= key_cnt)
+    {
+        return -1;
+    }
+    slot = key_slot(thread_curr, key, TRUE);
+    if (slot == NULL)
+    {
+        return -1;
+    }
+    *slot = (void *)value;
+    return 0;
+}
+
+/*
+ * Description: runs destructors for an exiting thread's non-NULL values.
+ * Each value is cleared before its destructor sees it; destructors that
+ * set values cause another pass, up to LWP_KEY_DTOR_ROUNDS.
+ * Params: thread t (the one exiting)
+ * Return: void
+ */
+void lwp_key_exit(thread t)
+{
+    int round, again = TRUE;
+    lwp_key_t key;
+    void **slot, *value;
+
+    for (round = 0; round < LWP_KEY_DTOR_ROUNDS && again; round++)
+    {
+        again = FALSE;
+        for (key = 0; key < key_cnt; key++)
+        {
+            if (key_dtor[key] == NULL)
+            {
+                continue;
+            }
+            slot = key_slot(t, key, FALSE);
+            if (slot == NULL || *slot == NULL)
+            {
+                continue;
+            }
+            value = *slot;
+            *slot = NULL;
+            key_dtor[key](value);
+            again = TRUE;
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef LWPKEYH
+#define LWPKEYH
+#include <stddef.h>
+#include "lwp.h"
+
+/* LWP-local storage. __thread variables are per kernel thread, so every
+ * LWP would share them; these are per LWP. Keys below LWP_KEYS_INLINE live
+ * in the context itself and cost two loads (thread_curr, then the slot);
+ * later keys go to a per-thread table grown on first use. Destructors run
+ * in lwp_exit(), on the exiting thread. There is no LWP before
+ * lwp_start(): lwp_getspecific() returns NULL and lwp_setspecific() fails. */
+
+#define LWP_KEYS_MAX 1024
+#define LWP_KEY_DTOR_ROUNDS 4 /* passes over the keys while destructors set new values */
+
+typedef unsigned int lwp_key_t;
+typedef void (*lwp_key_dtor)(void *value);
+
+extern unsigned int lwp_key_dtors; /* keys with a destructor */
+
+extern int lwp_key_create(lwp_key_t *key, lwp_key_dtor dtor);
+extern void *lwp_getspecific_slow(lwp_key_t key);
+extern int lwp_setspecific_slow(lwp_key_t key, const void *value);
+extern void lwp_key_exit(thread t);
+
+static inline void *lwp_getspecific(lwp_key_t key)
+{
+  if (key < LWP_KEYS_INLINE && thread_curr != NULL)
+  {
+    return thread_curr->specific[key];
+  }
+  return lwp_getspecific_slow(key);
+}
+
+static inline int lwp_setspecific(lwp_key_t key, const void *value)
+{
+  if (key < LWP_KEYS_INLINE && thread_curr != NULL)
+  {
+    thread_curr->specific[key] = (void *)value;
+    return 0;
+  }
+  return lwp_setspecific_slow(key, value);
+}
+
+/* lwp_exit() hook: skipped entirely while no key has a destructor */
+#define KEY_EXIT(t)                                                 \
+  do                                                                \
+  {                                                                 \
+    if (lwp_key_dtors)                                              \
+      lwp_key_exit(t);                                              \
+  } while (0)
+
+#endif
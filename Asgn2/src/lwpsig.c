@@ -0,0 +1,86 @@
+#include "lwpsig.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+
+/*
+ * Summary: deferred signal dispatch. The installed handler touches nothing
+ * but two lock-free atomics (a per-signal count and the pending mask), so
+ * it is async-signal-safe and can't tear the runtime or a snake halfway
+ * through a move. lwp_dispatch() checks the mask on every switch and runs
+ * the callbacks from there. Counts are kept as well as bits, so a burst of
+ * signals between two switches still runs the callback once per signal.
+ */
+
+unsigned long long lwp_sig_pending = 0;
+
+static unsigned int sig_count[LWP_SIG_MAX + 1];
+static lwp_sigfun sig_fun[LWP_SIG_MAX + 1];
+
+/******************** Support Functions *******************/
+/*
+ * Description: the real handler: count the signal and mark it pending
+ * Params: signal number
+ * Return: void
+ */
+static void sig_record(int sig)
+{
+    __atomic_add_fetch(&sig_count[sig], 1, __ATOMIC_RELAXED);
+    __atomic_or_fetch(&lwp_sig_pending, 1ull << (sig - 1), __ATOMIC_RELEASE);
+}
+
+/******************** Main Functions *******************/
+/*
+ * Description: routes a signal to a callback run at the next scheduling
+ * point; a NULL callback restores the default action
+ * Params: signal number and callback
+ * Return: 0 on success, -1 on failure
+ */
+int lwp_signal_handle(int sig, lwp_sigfun fun)
+{
+    struct sigaction sa;
+
+    if (sig <= 0 || sig > LWP_SIG_MAX)
+    {
+        fprintf(stderr, "lwp_signal_handle: bad signal %d\n", sig);
+        return -1;
+    }
+
+    sig_fun[sig] = fun;
+    sa.sa_handler = fun != NULL ? sig_record : SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(sig, &sa, NULL) < 0)
+    {
+        perror("lwp_signal_handle");
+        sig_fun[sig] = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Description: runs the callbacks for every pending signal, once per time
+ * it was delivered. Signals that arrive meanwhile are left for the next
+ * call.
+ * Params: void
+ * Return: void
+ */
+void lwp_signal_dispatch(void)
+{
+    unsigned long long mask;
+    unsigned int n;
+    int sig;
+
+    mask = __atomic_exchange_n(&lwp_sig_pending, 0, __ATOMIC_ACQUIRE);
+    while (mask != 0)
+    {
+        sig = __builtin_ctzll(mask) + 1;
+        mask &= mask - 1;
+        n = __atomic_exchange_n(&sig_count[sig], 0, __ATOMIC_RELAXED);
+        while (n-- > 0 && sig_fun[sig] != NULL)
+        {
+            sig_fun[sig](sig);
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef LWPSIGH
+#define LWPSIGH
+#include "lwp.h"
+
+/* deferred signal handling: the real handler only counts the signal and
+ * sets its bit in an atomic pending mask; the callback registered with
+ * lwp_signal_handle() runs at the next scheduling point, once per signal,
+ * in ordinary LWP context instead of on top of whatever was interrupted.
+ * Callbacks may use the runtime (lwp_wake(), scheduler state) but must not
+ * block or yield. */
+
+#define LWP_SIG_MAX 64 /* signals 1..64 fit the mask */
+
+typedef void (*lwp_sigfun)(int sig);
+
+extern unsigned long long lwp_sig_pending; /* bit sig - 1 per pending signal */
+
+extern int lwp_signal_handle(int sig, lwp_sigfun fun);
+extern void lwp_signal_dispatch(void);
+
+/* called by the dispatcher; one load when nothing is pending */
+#define LWP_SIG_POLL()                                              \
+  do                                                                \
+  {                                                                 \
+    if (__atomic_load_n(&lwp_sig_pending, __ATOMIC_RELAXED) != 0)   \
+      lwp_signal_dispatch();                                        \
+  } while (0)
+
+#endif
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include "lwpsleep.h"
+#include "offload.h"
+#include "tsc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Summary: sleeping LWPs wait in a binary min-heap ordered by deadline.
+ * lwp_sleep_until() pushes the caller and parks it with lwp_block().
+ * sleep_poll() pops every entry that is due and wakes it, which costs one
+ * clock read per switch while anyone is asleep. sleep_idle() is for the
+ * dispatcher when nothing is runnable. It sleeps the process until the
+ * earliest deadline, or waits on the offload pool with that deadline as a
+ * timeout when LWPs are parked there too.
+ */
+
+typedef struct sleeper
+{
+    uint64_t deadline; /* now_ns() at which to wake */
+    thread t;
+} sleeper;
+
+int sleep_cnt = 0;
+static sleeper *heap = NULL;
+static int heap_cap = 0;
+
+/******************** Support Functions *******************/
+/*
+ * Description: adds a sleeper, growing the heap if it is full
+ * Params: thread and its deadline
+ * Return: 0 on success, -1 if out of memory
+ */
+static int heap_push(thread t, uint64_t deadline)
+{
+    sleeper *bigger;
+    int i, up;
+
+    if (sleep_cnt == heap_cap)
+    {
+        bigger = realloc(heap, (heap_cap ? 2 * heap_cap : SLEEP_HEAP_INIT) * sizeof(sleeper));
+        if (bigger == NULL)
+        {
+            return -1;
+        }
+        heap = bigger;
+        heap_cap = heap_cap ? 2 * heap_cap : SLEEP_HEAP_INIT;
+    }
+
+    /* sift up from the new leaf */
+    for (i = sleep_cnt++; i > 0; i = up)
+    {
+        up = (i - 1) / 2;
+        if (heap[up].deadline <= deadline)
+        {
+            break;
+        }
+        heap[i] = heap[up];
+    }
+    heap[i].deadline = deadline;
+    heap[i].t = t;
+    return 0;
+}
+
+/*
+ * Description: takes the earliest sleeper off the heap
+ * Params: void
+ * Return: its thread
+ */
+static thread heap_pop(void)
+{
+    thread top = heap[0].t;
+    sleeper last = heap[--sleep_cnt];
+    int i = 0, child;
+
+    /* sift the last leaf down from the root */
+    while ((child = 2 * i + 1) < sleep_cnt)
+    {
+        if (child + 1 < sleep_cnt && heap[child + 1].deadline < heap[child].deadline)
+        {
+            child++;
+        }
+        if (last.deadline <= heap[child].deadline)
+        {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*
+ * Description: sleeps the whole process until a deadline
+ * Params: deadline on the now_ns() clock
+ * Return: void (early if a signal arrives)
+ */
+static void kernel_sleep(uint64_t deadline)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/******************** Main Functions *******************/
+/*
+ * Description: parks the calling LWP until a deadline while the others
+ * run. A deadline that has already passed just yields. Outside of the LWP
+ * system there is nobody else to run, so it sleeps the process.
+ * Params: deadline on the now_ns() clock
+ * Return: void
+ */
+void lwp_sleep_until(uint64_t deadline)
+{
+    if (thread_curr == NULL)
+    {
+        while (now_ns() < deadline)
+        {
+            kernel_sleep(deadline);
+        }
+        return;
+    }
+    if (deadline <= now_ns())
+    {
+        lwp_yield();
+        return;
+    }
+    if (heap_push(thread_curr, deadline) < 0)
+    {
+        /* no room on the heap: wait it out by yielding */
+        while (now_ns() < deadline)
+        {
+            lwp_yield();
+        }
+        return;
+    }
+
+    /* park until sleep_poll() wakes us */
+    lwp_block(LWP_BLOCK_SLEEP);
+}
+
+/*
+ * Description: parks the calling LWP for a while
+ * Params: nanoseconds
+ * Return: void
+ */
+void lwp_sleep_ns(uint64_t ns)
+{
+    lwp_sleep_until(now_ns() + ns);
+}
+
+/*
+ * Description: wakes every sleeper whose deadline has passed, earliest
+ * first
+ * Params: void
+ * Return: void
+ */
+void sleep_poll(void)
+{
+    uint64_t now;
+
+    if (sleep_cnt == 0)
+    {
+        return;
+    }
+    now = now_ns();
+    while (sleep_cnt != 0 && heap[0].deadline <= now)
+    {
+        lwp_wake(heap_pop());
+    }
+}
+
+/*
+ * Description: for the dispatcher when nothing is runnable: waits in the
+ * kernel until the earliest deadline, or until an offload job finishes if
+ * that comes first, then wakes whoever is due
+ * Params: void
+ * Return: void
+ */
+void sleep_idle(void)
+{
+    if (sleep_cnt == 0)
+    {
+        return;
+    }
+    if (offload_pending())
+    {
+        offload_wait(heap[0].deadline);
+    }
+    else
+    {
+        kernel_sleep(heap[0].deadline);
+    }
+    sleep_poll();
+}
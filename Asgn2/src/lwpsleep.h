@@ -0,0 +1,31 @@
+#ifndef LWPSLEEPH
+#define LWPSLEEPH
+#include <stdint.h>
+#include "lwp.h"
+
+/* timed sleep for LWPs. A sleeping LWP parks on a deadline heap rather than
+ * holding a helper pthread in usleep(), so any number of them can sleep at
+ * once. lwp_dispatch() wakes the ones that are due at every switch, and
+ * only when nothing is runnable does the process sleep in the kernel, until
+ * the earliest deadline or an offload completion. Deadlines are on the
+ * now_ns() clock (tsc.h). */
+
+#define SLEEP_HEAP_INIT 64 /* deadline heap slots allocated at first use */
+
+extern void lwp_sleep_until(uint64_t deadline);
+extern void lwp_sleep_ns(uint64_t ns);
+
+/* hooks for the scheduler loop in lwp.c */
+extern int sleep_cnt; /* LWPs parked in lwp_sleep_until() */
+extern void sleep_poll(void);
+extern void sleep_idle(void);
+
+/* sleep_poll() without the call when nobody is asleep */
+#define SLEEP_POLL()              \
+  do                              \
+  {                               \
+    if (sleep_cnt != 0)           \
+      sleep_poll();               \
+  } while (0)
+
+#endif
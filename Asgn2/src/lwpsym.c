@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include "lwpsym.h"
+#include <stdint.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Summary: symbol lookup for reports. dladdr() is tried first; for the
+ * addresses it cannot name, the .symtab of /proc/self/exe is mapped
+ * once, on first use, and searched for the function that contains the
+ * address. The mapping is kept for the life of the process. Lookups are a
+ * linear scan, which is fine for reports but not for hot paths.
+ */
+
+static int loaded = 0;
+static const Elf64_Sym *syms = NULL; /* the executable's .symtab */
+static size_t nsyms = 0;
+static const char *strs = NULL;       /* and its string table     */
+static uintptr_t bias = 0;            /* load address of the executable */
+static uintptr_t exe_lo = 0, exe_hi = 0; /* its mapped segments   */
+
+/******************** Support Functions *******************/
+/*
+ * Description: dl_iterate_phdr() callback that records where the
+ * executable, always the first object, is loaded
+ * Params: object info, its size and unused
+ * Return: 1 to stop after the first object
+ */
+static int exe_range(struct dl_phdr_info *info, size_t size, void *unused)
+{
+    uintptr_t lo, hi;
+    int i;
+
+    bias = info->dlpi_addr;
+    for (i = 0; i < info->dlpi_phnum; i++)
+    {
+        if (info->dlpi_phdr[i].p_type != PT_LOAD)
+        {
+            continue;
+        }
+        lo = bias + info->dlpi_phdr[i].p_vaddr;
+        hi = lo + info->dlpi_phdr[i].p_memsz;
+        if (exe_lo == 0 || lo < exe_lo)
+        {
+            exe_lo = lo;
+        }
+        if (hi > exe_hi)
+        {
+            exe_hi = hi;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Description: maps the executable and finds its symbol table. Leaves
+ * nsyms at 0 if there is none or the file can't be read.
+ * Params: void
+ * Return: void
+ */
+static void symtab_load(void)
+{
+    const Elf64_Ehdr *eh;
+    const Elf64_Shdr *sh;
+    struct stat st;
+    const char *map;
+    size_t size;
+    int fd, i;
+
+    loaded = 1;
+    dl_iterate_phdr(exe_range, NULL);
+    fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Elf64_Ehdr))
+    {
+        close(fd);
+        return;
+    }
+    size = st.st_size;
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return;
+    }
+
+    eh = (const Elf64_Ehdr *)map;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf64_Shdr) > size)
+    {
+        munmap((void *)map, size);
+        return;
+    }
+    sh = (const Elf64_Shdr *)(map + eh->e_shoff);
+    for (i = 0; i < eh->e_shnum; i++)
+    {
+        if (sh[i].sh_type == SHT_SYMTAB && sh[i].sh_link < eh->e_shnum &&
+            sh[i].sh_offset + sh[i].sh_size <= size &&
+            sh[sh[i].sh_link].sh_offset + sh[sh[i].sh_link].sh_size <= size)
+        {
+            syms = (const Elf64_Sym *)(map + sh[i].sh_offset);
+            nsyms = sh[i].sh_size / sizeof(Elf64_Sym);
+            strs = map + sh[sh[i].sh_link].sh_offset;
+            return;
+        }
+    }
+    munmap((void *)map, size);
+}
+
+/******************** Main Functions *******************/
+/*
+ * Description: names the function that contains a code address
+ * Params: address, and where to put the function's start (may be NULL)
+ * Return: the name, or NULL if nothing is known about the address
+ */
+const char *lwp_symname(const void *addr, const void **start)
+{
+    Dl_info info;
+    uintptr_t a = (uintptr_t)addr;
+    size_t i;
+
+    if (dladdr(addr, &info) && info.dli_sname != NULL)
+    {
+        if (start != NULL)
+        {
+            *start = info.dli_saddr;
+        }
+        return info.dli_sname;
+    }
+
+    if (!loaded)
+    {
+        symtab_load();
+    }
+    if (a < exe_lo || a >= exe_hi)
+    {
+        return NULL;
+    }
+    a -= bias;
+    for (i = 0; i < nsyms; i++)
+    {
+        if (ELF64_ST_TYPE(syms[i].st_info) == STT_FUNC && syms[i].st_shndx != SHN_UNDEF &&
+            a >= syms[i].st_value && a < syms[i].st_value + syms[i].st_size)
+        {
+            if (start != NULL)
+            {
+                *start = (const void *)(syms[i].st_value + bias);
+            }
+            return strs + syms[i].st_name;
+        }
+    }
+    return NULL;
+}
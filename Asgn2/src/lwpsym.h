@@ -0,0 +1,11 @@
+#ifndef LWPSYMH
+#define LWPSYMH
+
+/* names for code addresses in reports. dladdr() only knows dynamic
+ * symbols, so static functions (most thread bodies) come back unnamed;
+ * lwp_symname() then looks the address up in the executable's own symbol
+ * table, which is there unless the binary was stripped. */
+
+extern const char *lwp_symname(const void *addr, const void **start);
+
+#endif
@@ -0,0 +1,188 @@
+#include "lwpsync.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+/*
+ * Summary: fan-out/fan-in primitives for LWPs. Each object keeps a FIFO of
+ * parked threads; when it opens, the whole list is handed to lwp_wake_all()
+ * in one go instead of waking the waiters one at a time.
+ */
+
+/******************** Support Functions *******************/
+/*
+ * Description: parks the current thread on a wait list
+ * Params: lwp_waitlist *wl and what it is (LWP_BLOCK_*)
+ * Return: void (returns once the list is released)
+ */
+static void waitlist_park(lwp_waitlist *wl, int reason)
+{
+    thread_curr->q_next = NULL;
+    if (wl->last == NULL)
+    {
+        wl->first = thread_curr;
+    }
+    else
+    {
+        wl->last->q_next = thread_curr;
+    }
+    wl->last = thread_curr;
+
+    lwp_block(reason);
+}
+
+/*
+ * Description: empties a wait list and makes everyone on it runnable
+ * Params: lwp_waitlist *wl
+ * Return: void
+ */
+static void waitlist_release(lwp_waitlist *wl)
+{
+    thread first = wl->first;
+
+    wl->first = NULL;
+    wl->last = NULL;
+    if (first != NULL)
+    {
+        lwp_wake_all(first);
+    }
+}
+
+/******************** Wait Groups *******************/
+/*
+ * Description: sets up an empty wait group
+ * Params: lwp_waitgroup *wg
+ * Return: void
+ */
+void lwp_waitgroup_init(lwp_waitgroup *wg)
+{
+    wg->count = 0;
+    wg->waiters.first = NULL;
+    wg->waiters.last = NULL;
+}
+
+/*
+ * Description: adds delta outstanding tasks (negative to finish some)
+ * Params: lwp_waitgroup *wg and long delta
+ * Return: void
+ */
+void lwp_waitgroup_add(lwp_waitgroup *wg, long delta)
+{
+    wg->count += delta;
+    if (wg->count < 0)
+    {
+        fprintf(stderr, "lwp_waitgroup_add: negative counter\n");
+        exit(EXIT_FAILURE);
+    }
+    if (wg->count == 0)
+    {
+        waitlist_release(&wg->waiters);
+    }
+}
+
+/*
+ * Description: marks one task finished
+ * Params: lwp_waitgroup *wg
+ * Return: void
+ */
+void lwp_waitgroup_done(lwp_waitgroup *wg)
+{
+    lwp_waitgroup_add(wg, -1);
+}
+
+/*
+ * Description: blocks until the counter drops to zero
+ * Params: lwp_waitgroup *wg
+ * Return: void
+ */
+void lwp_waitgroup_wait(lwp_waitgroup *wg)
+{
+    if (wg->count > 0)
+    {
+        waitlist_park(&wg->waiters, LWP_BLOCK_WAITGROUP);
+    }
+}
+
+/******************** Barriers *******************/
+/*
+ * Description: sets up a barrier for a number of parties
+ * Params: lwp_barrier *b and unsigned int parties
+ * Return: void
+ */
+void lwp_barrier_init(lwp_barrier *b, unsigned int parties)
+{
+    b->parties = parties;
+    b->arrived = 0;
+    b->waiters.first = NULL;
+    b->waiters.last = NULL;
+}
+
+/*
+ * Description: blocks until all parties have arrived, then resets for the
+ * next round
+ * Params: lwp_barrier *b
+ * Return: LWP_BARRIER_SERIAL for the last party to arrive, 0 for the others
+ */
+int lwp_barrier_wait(lwp_barrier *b)
+{
+    b->arrived++;
+    if (b->arrived < b->parties)
+    {
+        waitlist_park(&b->waiters, LWP_BLOCK_BARRIER);
+        return 0;
+    }
+
+    /* last one in releases the round */
+    b->arrived = 0;
+    waitlist_release(&b->waiters);
+    return LWP_BARRIER_SERIAL;
+}
+
+/******************** Latches *******************/
+/*
+ * Description: sets up a latch that opens after count count-downs
+ * Params: lwp_latch *l and long count
+ * Return: void
+ */
+void lwp_latch_init(lwp_latch *l, long count)
+{
+    l->count = count;
+    l->waiters.first = NULL;
+    l->waiters.last = NULL;
+}
+
+/*
+ * Description: counts the latch down by one, opening it at zero
+ * Params: lwp_latch *l
+ * Return: void
+ */
+void lwp_latch_count_down(lwp_latch *l)
+{
+    if (l->count > 0 && --l->count == 0)
+    {
+        waitlist_release(&l->waiters);
+    }
+}
+
+/*
+ * Description: blocks until the latch is open
+ * Params: lwp_latch *l
+ * Return: void
+ */
+void lwp_latch_wait(lwp_latch *l)
+{
+    if (l->count > 0)
+    {
+        waitlist_park(&l->waiters, LWP_BLOCK_LATCH);
+    }
+}
+
+/*
+ * Description: counts down and then waits for the latch to open
+ * Params: lwp_latch *l
+ * Return: void
+ */
+void lwp_latch_arrive_and_wait(lwp_latch *l)
+{
+    lwp_latch_count_down(l);
+    lwp_latch_wait(l);
+}
@@ -0,0 +1,49 @@
+#ifndef LWPSYNCH
+#define LWPSYNCH
+#include "lwp.h"
+
+/* list of LWPs parked on a sync object, linked through q_next */
+typedef struct lwp_waitlist
+{
+  thread first;
+  thread last;
+} lwp_waitlist;
+
+/* Go-style wait group: wait() returns once every add() has a done() */
+typedef struct lwp_waitgroup
+{
+  long count;
+  lwp_waitlist waiters;
+} lwp_waitgroup;
+
+/* reusable barrier for a fixed number of parties */
+typedef struct lwp_barrier
+{
+  unsigned int parties;
+  unsigned int arrived;
+  lwp_waitlist waiters;
+} lwp_barrier;
+
+/* single-use countdown latch */
+typedef struct lwp_latch
+{
+  long count;
+  lwp_waitlist waiters;
+} lwp_latch;
+
+#define LWP_BARRIER_SERIAL 1 /* returned to the last party to arrive */
+
+extern void lwp_waitgroup_init(lwp_waitgroup *wg);
+extern void lwp_waitgroup_add(lwp_waitgroup *wg, long delta);
+extern void lwp_waitgroup_done(lwp_waitgroup *wg);
+extern void lwp_waitgroup_wait(lwp_waitgroup *wg);
+
+extern void lwp_barrier_init(lwp_barrier *b, unsigned int parties);
+extern int lwp_barrier_wait(lwp_barrier *b);
+
+extern void lwp_latch_init(lwp_latch *l, long count);
+extern void lwp_latch_count_down(lwp_latch *l);
+extern void lwp_latch_wait(lwp_latch *l);
+extern void lwp_latch_arrive_and_wait(lwp_latch *l);
+
+#endif
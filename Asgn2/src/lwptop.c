@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "metrics.h"
+#include "tsc.h"
+
+/*
+ * Summary: live view of an LWP process's metrics file (see metrics.h).
+ * Prints the gauges and the counter rates over each interval until the
+ * process goes away.
+ *
+ * usage: lwptop <pid|file> [seconds]   (0 seconds prints once)
+ */
+
+static const char *reason_names[LWP_BLOCK_REASONS] = LWP_BLOCK_NAMES;
+
+/*
+ * Description: prints one screen
+ * Params: current snapshot, previous one (NULL on the first screen) and
+ * seconds between them
+ * Return: void
+ */
+static void show(const lwp_metrics *m, const lwp_metrics *prev, double dt)
+{
+    int i;
+
+    if (isatty(STDOUT_FILENO))
+    {
+        fputs("\033[H\033[2J", stdout);
+    }
+    printf("pid %u  up %lds\n", m->pid, (long)(time(NULL) - m->started));
+    printf("runnable %lld  live %llu  stack pool %llu/%llu\n",
+           (long long)m->runnable, (unsigned long long)m->live,
+           (unsigned long long)m->stack_pool, (unsigned long long)m->stack_pool_max);
+    printf("blocked:");
+    for (i = 1; i < LWP_BLOCK_REASONS; i++)
+    {
+        printf(" %s %llu", reason_names[i], (unsigned long long)m->blocked[i]);
+    }
+    printf("\n%10s %14s %12s\n", "", "total", "per sec");
+#define ROW(name, field)                                                    \
+    printf("%10s %14llu %12.0f\n", name, (unsigned long long)m->field,      \
+           prev != NULL && dt > 0 ? (m->field - prev->field) / dt : 0.0)
+    ROW("switches", switches);
+    ROW("creations", creations);
+    ROW("exits", exits);
+    ROW("reaps", reaps);
+#undef ROW
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    char path[256];
+    const volatile lwp_metrics *mx;
+    lwp_metrics cur, prev;
+    double interval = 1.0, t, last = 0;
+    int fd;
+
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "usage: %s <pid|file> [seconds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (strspn(argv[1], "0123456789") == strlen(argv[1]))
+    {
+        snprintf(path, sizeof(path), "%s/lwp.%s", METRICS_DIR, argv[1]);
+    }
+    else
+    {
+        snprintf(path, sizeof(path), "%s", argv[1]);
+    }
+    if (argc == 3)
+    {
+        interval = atof(argv[2]);
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    mx = mmap(NULL, sizeof(lwp_metrics), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mx == MAP_FAILED)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    if (memcmp((const void *)mx->magic, METRICS_MAGIC, sizeof(mx->magic)) != 0 ||
+        mx->version != METRICS_VERSION)
+    {
+        fprintf(stderr, "%s: not a version %d LWP metrics file\n", path, METRICS_VERSION);
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;)
+    {
+        memcpy(&cur, (const void *)mx, sizeof(cur));
+        t = now_ns() / 1e9;
+        show(&cur, last > 0 ? &prev : NULL, last > 0 ? t - last : 0);
+        if (interval <= 0)
+        {
+            break;
+        }
+        prev = cur;
+        last = t;
+        usleep(interval * 1e6);
+        if (kill(cur.pid, 0) < 0 && errno == ESRCH)
+        {
+            printf("pid %u exited\n", cur.pid);
+            break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "metrics.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Summary: publishes runtime counters in a file-backed shared mapping. The
+ * hot path does an ordinary increment through lwp_mx, which points at a
+ * private struct until metrics are turned on; starting copies the counts
+ * so far into the mapping and repoints lwp_mx at it. Everything runs on one
+ * kernel thread, so writers need no atomics; a reader may see a counter a
+ * switch late, which is fine for a monitor.
+ */
+
+static lwp_metrics private_mx;
+lwp_metrics *lwp_mx = &private_mx;
+int lwp_metrics_on = FALSE;
+
+static char shm_path[256];
+static int atexit_done = FALSE;
+
+/******************** Main Functions *******************/
+/*
+ * Description: starts publishing metrics. The file is removed again by
+ * lwp_metrics_stop(), which runs at exit.
+ * Params: path of the file (NULL for METRICS_DIR/lwp.<pid>)
+ * Return: 0 on success, -1 on failure
+ */
+int lwp_metrics_start(const char *path)
+{
+    lwp_metrics *mx;
+    int fd;
+
+    lwp_metrics_stop();
+
+    if (path == NULL)
+    {
+        snprintf(shm_path, sizeof(shm_path), "%s/lwp.%d", METRICS_DIR, (int)getpid());
+    }
+    else
+    {
+        snprintf(shm_path, sizeof(shm_path), "%s", path);
+    }
+
+    fd = open(shm_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror(shm_path);
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(lwp_metrics)) < 0)
+    {
+        perror(shm_path);
+        close(fd);
+        unlink(shm_path);
+        return -1;
+    }
+    mx = mmap(NULL, sizeof(lwp_metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mx == MAP_FAILED)
+    {
+        perror(shm_path);
+        unlink(shm_path);
+        return -1;
+    }
+
+    /* carry the counts so far over; magic last so readers see a whole page */
+    *mx = private_mx;
+    mx->version = METRICS_VERSION;
+    mx->pid = getpid();
+    mx->started = time(NULL);
+    mx->stack_pool_max = STACK_POOL_MAX;
+    memcpy(mx->magic, METRICS_MAGIC, sizeof(mx->magic));
+
+    lwp_mx = mx;
+    lwp_metrics_on = TRUE;
+    if (!atexit_done)
+    {
+        atexit(lwp_metrics_stop);
+        atexit_done = TRUE;
+    }
+    return 0;
+}
+
+/*
+ * Description: stops publishing and removes the file
+ * Params: void
+ * Return: void
+ */
+void lwp_metrics_stop(void)
+{
+    if (!lwp_metrics_on)
+    {
+        return;
+    }
+    private_mx = *lwp_mx;
+    munmap(lwp_mx, sizeof(lwp_metrics));
+    lwp_mx = &private_mx;
+    lwp_metrics_on = FALSE;
+    unlink(shm_path);
+}
@@ -0,0 +1,41 @@
+#ifndef METRICSH
+#define METRICSH
+#include <stdint.h>
+#include "lwp.h"
+
+/* live metrics: counters and gauges kept in a shared mapping (by default
+ * /dev/shm/lwp.<pid>) that lwptop, or anything else, can read while the
+ * process runs. The runtime updates them with plain stores. */
+
+#define METRICS_MAGIC "LWPMETRC"
+#define METRICS_VERSION 2
+#define METRICS_DIR "/dev/shm"
+
+typedef struct lwp_metrics
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t pid;
+  int64_t started;      /* time() at lwp_metrics_start()           */
+  /* gauges */
+  int64_t runnable;     /* sched->qlen() at the last switch, -1 if
+                           the scheduler can't tell                  */
+  uint64_t live;        /* LWPs created and not yet freed           */
+  uint64_t blocked[LWP_BLOCK_REASONS]; /* parked, by LWP_BLOCK_*    */
+  uint64_t stack_pool;  /* stacks cached for reuse                  */
+  uint64_t stack_pool_max;
+  /* counters */
+  uint64_t switches;
+  uint64_t creations;
+  uint64_t exits;
+  uint64_t reaps;       /* collected by wait/join                    */
+} lwp_metrics;
+
+/* never NULL: points at a private copy until lwp_metrics_start() */
+extern lwp_metrics *lwp_mx;
+extern int lwp_metrics_on;
+
+extern int lwp_metrics_start(const char *path);
+extern void lwp_metrics_stop(void);
+
+#endif
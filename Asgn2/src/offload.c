@@ -0,0 +1,361 @@
+#define _GNU_SOURCE
+#include "offload.h"
+#include "tsc.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Summary: runs blocking calls for LWPs on a small pool of helper pthreads.
+ * The calling LWP parks itself, its job goes into a bounded submission ring,
+ * a helper runs it and pushes it onto a completion list, and the scheduler
+ * loop in lwp.c drains that list and re-admits the LWP. Jobs live on the
+ * parked LWP's stack, so nothing is allocated per call.
+ */
+
+typedef struct offload_job
+{
+    offloadfun fun;
+    void *arg;
+    void *result;
+    thread owner;                   /* LWP parked on this job */
+    uint64_t t_submit;              /* timestamps in ns       */
+    uint64_t t_start;
+    uint64_t t_done;
+    struct offload_job *next;       /* completion list link   */
+} offload_job;
+
+static pthread_t helpers[OFFLOAD_MAX_HELPERS];
+static int helper_cnt = 0;
+static int stopping = 0;
+
+/* submission ring, guarded by sub_lock */
+static pthread_mutex_t sub_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sub_cv = PTHREAD_COND_INITIALIZER;
+static offload_job *sub_ring[OFFLOAD_QUEUE_SIZE];
+static int sub_head = 0;
+static int sub_len = 0;
+static int sub_max = 0;
+
+/* completion list, guarded by done_lock; done_cnt is peeked without it */
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cv = PTHREAD_COND_INITIALIZER;
+static offload_job *done_head = NULL;
+static offload_job *done_tail = NULL;
+static int done_cnt = 0;
+
+/* only touched from the LWP side */
+int offload_inflight = 0;
+static unsigned long submitted = 0;
+static unsigned long completed = 0;
+static unsigned long queue_hist[OFFLOAD_HIST_BUCKETS];
+static unsigned long service_hist[OFFLOAD_HIST_BUCKETS];
+static unsigned long total_hist[OFFLOAD_HIST_BUCKETS];
+
+/******************** Support Functions *******************/
+/*
+ * Description: adds a latency to a log2 histogram
+ * Params: histogram and latency in ns
+ * Return: void
+ */
+static void hist_add(unsigned long *hist, uint64_t ns)
+{
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+
+    if (bucket >= OFFLOAD_HIST_BUCKETS)
+    {
+        bucket = OFFLOAD_HIST_BUCKETS - 1;
+    }
+    hist[bucket]++;
+}
+
+/*
+ * Description: body of each helper pthread, runs jobs until shutdown
+ * Params: unused
+ * Return: NULL
+ */
+static void *helper_main(void *unused)
+{
+    offload_job *job;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&sub_lock);
+        while (sub_len == 0 && !stopping)
+        {
+            pthread_cond_wait(&sub_cv, &sub_lock);
+        }
+        if (sub_len == 0)
+        {
+            pthread_mutex_unlock(&sub_lock);
+            return NULL;
+        }
+        job = sub_ring[sub_head];
+        sub_head = (sub_head + 1) % OFFLOAD_QUEUE_SIZE;
+        sub_len--;
+        pthread_mutex_unlock(&sub_lock);
+
+        job->t_start = now_ns();
+        job->result = job->fun(job->arg);
+        job->t_done = now_ns();
+
+        /* hand the job back to the LWP side */
+        job->next = NULL;
+        pthread_mutex_lock(&done_lock);
+        if (done_tail == NULL)
+        {
+            done_head = job;
+        }
+        else
+        {
+            done_tail->next = job;
+        }
+        done_tail = job;
+        __atomic_add_fetch(&done_cnt, 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&done_cv);
+        pthread_mutex_unlock(&done_lock);
+    }
+}
+
+/******************** Main Functions *******************/
+
+/*
+ * Description: starts the helper pool. Called lazily by the first
+ * lwp_offload(); call it earlier to pick the size up front.
+ * Params: number of helpers (<= 0 uses $LWP_OFFLOAD_HELPERS or the default)
+ * Return: number of helpers running, -1 on failure
+ */
+int lwp_offload_init(int nhelpers)
+{
+    sigset_t all, old;
+    char *env;
+
+    if (helper_cnt > 0)
+    {
+        return helper_cnt;
+    }
+
+    if (nhelpers <= 0)
+    {
+        env = getenv("LWP_OFFLOAD_HELPERS");
+        nhelpers = env ? atoi(env) : OFFLOAD_DEFAULT_HELPERS;
+    }
+    if (nhelpers <= 0)
+    {
+        nhelpers = OFFLOAD_DEFAULT_HELPERS;
+    }
+    if (nhelpers > OFFLOAD_MAX_HELPERS)
+    {
+        nhelpers = OFFLOAD_MAX_HELPERS;
+    }
+
+    /* helpers inherit a full mask so signals keep landing on the LWPs */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    stopping = 0;
+    while (helper_cnt < nhelpers)
+    {
+        if (pthread_create(&helpers[helper_cnt], NULL, helper_main, NULL) != 0)
+        {
+            perror("lwp_offload_init");
+            break;
+        }
+        helper_cnt++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return helper_cnt > 0 ? helper_cnt : -1;
+}
+
+/*
+ * Description: stops and joins the helpers once the queue has drained
+ * Params: void
+ * Return: void
+ */
+void lwp_offload_shutdown(void)
+{
+    int i;
+
+    pthread_mutex_lock(&sub_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&sub_cv);
+    pthread_mutex_unlock(&sub_lock);
+
+    for (i = 0; i < helper_cnt; i++)
+    {
+        pthread_join(helpers[i], NULL);
+    }
+    helper_cnt = 0;
+}
+
+/*
+ * Description: runs fun(arg) on a helper pthread while the calling LWP is
+ * parked, so the other LWPs keep running during a blocking call
+ * Params: offloadfun fun and void *arg
+ * Return: whatever fun returned
+ */
+void *lwp_offload(offloadfun fun, void *arg)
+{
+    offload_job job;
+
+    /* outside of the LWP system there is nobody else to run */
+    if (thread_curr == NULL || lwp_offload_init(0) < 0)
+    {
+        return fun(arg);
+    }
+
+    job.fun = fun;
+    job.arg = arg;
+    job.owner = thread_curr;
+    job.next = NULL;
+
+    /* ring full: let others run (and drain completions) until there's room */
+    pthread_mutex_lock(&sub_lock);
+    while (sub_len == OFFLOAD_QUEUE_SIZE)
+    {
+        pthread_mutex_unlock(&sub_lock);
+        lwp_yield();
+        pthread_mutex_lock(&sub_lock);
+    }
+    job.t_submit = now_ns();
+    sub_ring[(sub_head + sub_len) % OFFLOAD_QUEUE_SIZE] = &job;
+    sub_len++;
+    if (sub_len > sub_max)
+    {
+        sub_max = sub_len;
+    }
+    pthread_cond_signal(&sub_cv);
+    pthread_mutex_unlock(&sub_lock);
+
+    offload_inflight++;
+    submitted++;
+
+    /* park until offload_poll() re-admits us */
+    lwp_block(LWP_BLOCK_OFFLOAD);
+
+    return job.result;
+}
+
+/*
+ * Description: tells the scheduler loop whether parked LWPs are outstanding
+ * Params: void
+ * Return: nonzero if some LWP is waiting on the pool
+ */
+int offload_pending(void)
+{
+    return offload_inflight;
+}
+
+/*
+ * Description: re-admits every LWP whose job has finished
+ * Params: block (if TRUE, waits for at least one completion)
+ * Return: void
+ */
+void offload_poll(int block)
+{
+    offload_job *job, *next;
+    uint64_t now;
+
+    if (offload_inflight == 0)
+    {
+        return;
+    }
+    if (!block && __atomic_load_n(&done_cnt, __ATOMIC_ACQUIRE) == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&done_lock);
+    while (block && done_head == NULL)
+    {
+        pthread_cond_wait(&done_cv, &done_lock);
+    }
+    job = done_head;
+    done_head = NULL;
+    done_tail = NULL;
+    __atomic_store_n(&done_cnt, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&done_lock);
+
+    now = now_ns();
+    while (job != NULL)
+    {
+        next = job->next; /* job dies once its owner runs */
+        hist_add(queue_hist, job->t_start - job->t_submit);
+        hist_add(service_hist, job->t_done - job->t_start);
+        hist_add(total_hist, now - job->t_submit);
+        offload_inflight--;
+        completed++;
+        lwp_wake(job->owner);
+        job = next;
+    }
+}
+
+/*
+ * Description: waits until some job has finished or a deadline passes,
+ * without re-admitting anyone (offload_poll() does that)
+ * Params: deadline on the now_ns() clock
+ * Return: void
+ */
+void offload_wait(uint64_t deadline)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    pthread_mutex_lock(&done_lock);
+    while (done_head == NULL &&
+           pthread_cond_clockwait(&done_cv, &done_lock, CLOCK_MONOTONIC, &ts) == 0)
+        ;
+    pthread_mutex_unlock(&done_lock);
+}
+
+/*
+ * Description: copies out the pool counters and histograms
+ * Params: struct offload_stats *out
+ * Return: void
+ */
+void lwp_offload_stats(struct offload_stats *out)
+{
+    pthread_mutex_lock(&sub_lock);
+    out->depth = sub_len;
+    out->max_depth = sub_max;
+    pthread_mutex_unlock(&sub_lock);
+
+    out->helpers = helper_cnt;
+    out->inflight = offload_inflight;
+    out->submitted = submitted;
+    out->completed = completed;
+    memcpy(out->queue_hist, queue_hist, sizeof(queue_hist));
+    memcpy(out->service_hist, service_hist, sizeof(service_hist));
+    memcpy(out->total_hist, total_hist, sizeof(total_hist));
+}
+
+/*
+ * Description: prints the pool counters and non-empty histogram buckets
+ * Params: FILE *out
+ * Return: void
+ */
+void lwp_offload_dump(FILE *out)
+{
+    struct offload_stats st;
+    int i;
+
+    lwp_offload_stats(&st);
+    fprintf(out, "offload: helpers %d depth %d (max %d) inflight %d "
+                 "submitted %lu completed %lu\n",
+            st.helpers, st.depth, st.max_depth, st.inflight,
+            st.submitted, st.completed);
+    fprintf(out, "%12s %10s %10s %10s\n", "< ns", "queue", "service", "total");
+    for (i = 0; i < OFFLOAD_HIST_BUCKETS; i++)
+    {
+        if (st.queue_hist[i] || st.service_hist[i] || st.total_hist[i])
+        {
+            fprintf(out, "%12llu %10lu %10lu %10lu\n", 1ull << i,
+                    st.queue_hist[i], st.service_hist[i], st.total_hist[i]);
+        }
+    }
+}
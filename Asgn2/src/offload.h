@@ -0,0 +1,48 @@
+#ifndef OFFLOADH
+#define OFFLOADH
+#include <stdio.h>
+#include <stdint.h>
+#include "lwp.h"
+
+#define OFFLOAD_DEFAULT_HELPERS 4 /* pool size if LWP_OFFLOAD_HELPERS unset */
+#define OFFLOAD_MAX_HELPERS 64
+#define OFFLOAD_QUEUE_SIZE 256 /* jobs waiting for a helper at once  */
+#define OFFLOAD_HIST_BUCKETS 32 /* bucket i counts latencies < 2^i ns  */
+
+typedef void *(*offloadfun)(void *); /* type for offloaded function */
+
+/* snapshot of the helper pool */
+struct offload_stats
+{
+  int helpers;             /* helper pthreads in the pool         */
+  int depth;               /* jobs waiting for a helper           */
+  int max_depth;           /* deepest the queue has been          */
+  int inflight;            /* LWPs parked in lwp_offload()        */
+  unsigned long submitted; /* jobs handed to the pool             */
+  unsigned long completed; /* LWPs re-admitted after their job    */
+  unsigned long queue_hist[OFFLOAD_HIST_BUCKETS];   /* submit -> start   */
+  unsigned long service_hist[OFFLOAD_HIST_BUCKETS]; /* start -> done     */
+  unsigned long total_hist[OFFLOAD_HIST_BUCKETS];   /* submit -> resumed */
+};
+
+extern int lwp_offload_init(int helpers);
+extern void lwp_offload_shutdown(void);
+extern void *lwp_offload(offloadfun fun, void *arg);
+extern void lwp_offload_stats(struct offload_stats *out);
+extern void lwp_offload_dump(FILE *out);
+
+/* hooks for the scheduler loop in lwp.c */
+extern int offload_inflight; /* LWPs parked in lwp_offload() */
+extern int offload_pending(void);
+extern void offload_poll(int block);
+extern void offload_wait(uint64_t deadline);
+
+/* offload_poll(FALSE) without the call when nothing is parked */
+#define OFFLOAD_POLL()            \
+  do                              \
+  {                               \
+    if (offload_inflight != 0)    \
+      offload_poll(FALSE);        \
+  } while (0)
+
+#endif
@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+#include "prof.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <dlfcn.h>
+#include <ucontext.h>
+#include <sys/time.h>
+
+/*
+ * Summary: the SIGPROF handler reads thread_curr and walks the rbp chain
+ * of the interrupted context. Frames are only followed while they stay
+ * inside the running LWP's stack (lwp_start() records main's too), so a garbage
+ * rbp from frame-pointer-less code ends the walk instead of faulting.
+ * Symbolizing and folding happen later in lwp_prof_dump(), outside the
+ * signal handler.
+ */
+
+static prof_sample ring[PROF_RING_SIZE];
+static volatile unsigned long ring_next = 0; /* total samples taken */
+static int running = FALSE;
+static FILE *dump_file = NULL;
+
+/******************** Support Functions *******************/
+/*
+ * Description: bounds of the stack the running LWP is on
+ * Params: lo and hi (out)
+ * Return: TRUE if known
+ */
+static int current_stack(uintptr_t *lo, uintptr_t *hi)
+{
+    if (thread_curr != NULL && thread_curr->stack != NULL)
+    {
+        *lo = (uintptr_t)thread_curr->stack;
+        *hi = *lo + thread_curr->stacksize;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Description: SIGPROF handler, takes one sample
+ * Params: signal number, info and interrupted ucontext
+ * Return: void
+ */
+static void prof_handler(int num, siginfo_t *info, void *uc_void)
+{
+    ucontext_t *uc = uc_void;
+    prof_sample *s = &ring[ring_next % PROF_RING_SIZE];
+    uintptr_t lo, hi, fp, next_fp;
+    unsigned int depth = 0;
+
+    s->tid = thread_curr != NULL ? thread_curr->tid : NO_THREAD;
+    s->pc[depth++] = (void *)uc->uc_mcontext.gregs[REG_RIP];
+
+    if (current_stack(&lo, &hi))
+    {
+        fp = uc->uc_mcontext.gregs[REG_RBP];
+        while (depth < PROF_MAX_DEPTH && fp >= lo && fp + 16 <= hi && fp % 8 == 0)
+        {
+            if (((void **)fp)[1] == NULL)
+            {
+                break; /* bottom frame of an LWP stack */
+            }
+            s->pc[depth++] = ((void **)fp)[1]; /* return address above saved rbp */
+            next_fp = ((uintptr_t *)fp)[0];
+            if (next_fp <= fp)
+            {
+                break; /* frames must move toward the top of the stack */
+            }
+            fp = next_fp;
+        }
+    }
+    s->depth = depth;
+    ring_next++;
+}
+
+/*
+ * Description: orders samples by tid and then by stack, for folding
+ * Params: two prof_samples
+ * Return: <0, 0, >0
+ */
+static int sample_cmp(const void *a, const void *b)
+{
+    const prof_sample *x = a, *y = b;
+    unsigned int i;
+
+    if (x->tid != y->tid)
+    {
+        return x->tid < y->tid ? -1 : 1;
+    }
+    for (i = 0; i < x->depth && i < y->depth; i++)
+    {
+        if (x->pc[i] != y->pc[i])
+        {
+            return (uintptr_t)x->pc[i] < (uintptr_t)y->pc[i] ? -1 : 1;
+        }
+    }
+    return (int)x->depth - (int)y->depth;
+}
+
+/*
+ * Description: moves every pc of a sample to the start of its function,
+ * so samples fold per function rather than per instruction
+ * Params: prof_sample *s
+ * Return: void
+ */
+static void sample_to_functions(prof_sample *s)
+{
+    Dl_info info;
+    unsigned int i;
+
+    for (i = 0; i < s->depth; i++)
+    {
+        if (dladdr(s->pc[i], &info) && info.dli_saddr != NULL)
+        {
+            s->pc[i] = info.dli_saddr;
+        }
+    }
+}
+
+/*
+ * Description: prints a code address as a function name if possible
+ * Params: FILE *out and pc
+ * Return: void
+ */
+static void print_frame(FILE *out, void *pc)
+{
+    Dl_info info;
+
+    if (dladdr(pc, &info) && info.dli_sname != NULL)
+    {
+        fputs(info.dli_sname, out);
+    }
+    else
+    {
+        fprintf(out, "%p", pc);
+    }
+}
+
+/*
+ * Description: writes the profile to $LWP_PROF at exit
+ * Params: void
+ * Return: void
+ */
+static void dump_at_exit(void)
+{
+    lwp_prof_dump(dump_file, PROF_ALL);
+    fclose(dump_file);
+}
+
+/******************** Main Functions *******************/
+/*
+ * Description: starts sampling at hz samples per second of CPU time.
+ * LWP_PROF=path at lwp_start() does this and writes the profile at exit.
+ * Params: int hz, 1 to PROF_MAX_HZ
+ * Return: 0 on success, -1 on failure (including an hz out of range)
+ */
+int lwp_prof_start(int hz)
+{
+    struct sigaction sa;
+    struct itimerval it;
+    char *env;
+
+    if (hz <= 0 || hz > PROF_MAX_HZ)
+    {
+        fprintf(stderr, "lwp_prof_start: %d Hz is out of range (1 to %d)\n", hz, PROF_MAX_HZ);
+        return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = prof_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    if (sigaction(SIGPROF, &sa, NULL) < 0)
+    {
+        perror("lwp_prof_start");
+        return -1;
+    }
+
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = 1000000 / hz;
+    it.it_value = it.it_interval;
+    if (setitimer(ITIMER_PROF, &it, NULL) < 0)
+    {
+        perror("lwp_prof_start");
+        return -1;
+    }
+    running = TRUE;
+
+    env = getenv("LWP_PROF");
+    if (env != NULL && dump_file == NULL)
+    {
+        dump_file = fopen(env, "w");
+        if (dump_file == NULL)
+        {
+            perror(env);
+        }
+        else
+        {
+            atexit(dump_at_exit);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Description: stops the sampling timer (samples are kept)
+ * Params: void
+ * Return: void
+ */
+void lwp_prof_stop(void)
+{
+    struct itimerval it;
+
+    if (running)
+    {
+        memset(&it, 0, sizeof(it));
+        setitimer(ITIMER_PROF, &it, NULL);
+        running = FALSE;
+    }
+}
+
+/*
+ * Description: stops sampling and writes the samples in folded-stack
+ * format, rooted at "lwp-<tid>" so each LWP is its own tower
+ * Params: FILE *out and tid (PROF_ALL for every LWP)
+ * Return: void
+ */
+void lwp_prof_dump(FILE *out, tid_t tid)
+{
+    prof_sample *samples;
+    unsigned long n, i, j, count;
+    int k;
+
+    lwp_prof_stop();
+
+    n = ring_next < PROF_RING_SIZE ? ring_next : PROF_RING_SIZE;
+    samples = malloc(n * sizeof(prof_sample));
+    if (samples == NULL)
+    {
+        perror("lwp_prof_dump");
+        return;
+    }
+    memcpy(samples, ring, n * sizeof(prof_sample));
+    for (i = 0; i < n; i++)
+    {
+        sample_to_functions(&samples[i]);
+    }
+    qsort(samples, n, sizeof(prof_sample), sample_cmp);
+
+    for (i = 0; i < n; i = j)
+    {
+        /* run of identical stacks */
+        for (j = i + 1; j < n && sample_cmp(&samples[i], &samples[j]) == 0; j++)
+            ;
+        count = j - i;
+        if (tid != PROF_ALL && samples[i].tid != tid)
+        {
+            continue;
+        }
+
+        fprintf(out, "lwp-%lu", samples[i].tid);
+        for (k = samples[i].depth - 1; k >= 0; k--)
+        {
+            fputc(';', out);
+            print_frame(out, samples[i].pc[k]);
+        }
+        fprintf(out, " %lu\n", count);
+    }
+    free(samples);
+}
@@ -0,0 +1,28 @@
+#ifndef PROFH
+#define PROFH
+#include <stdio.h>
+#include "lwp.h"
+
+/* SIGPROF sampling profiler that knows which LWP was running: each sample
+ * is the running tid plus a frame-pointer unwind of the interrupted code,
+ * written out as folded stacks (one "lwp-N;caller;...;leaf count" per line)
+ * for flamegraph.pl and friends */
+
+#define PROF_DEFAULT_HZ 997    /* prime, so it doesn't beat with timers */
+#define PROF_MAX_HZ 1000000    /* setitimer() counts in microseconds    */
+#define PROF_RING_SIZE 16384   /* samples kept; oldest are overwritten  */
+#define PROF_MAX_DEPTH 32      /* frames per sample                     */
+#define PROF_ALL ((tid_t)-1)   /* lwp_prof_dump() every LWP             */
+
+typedef struct prof_sample
+{
+  tid_t tid;
+  unsigned int depth;
+  void *pc[PROF_MAX_DEPTH]; /* leaf first */
+} prof_sample;
+
+extern int lwp_prof_start(int hz);
+extern void lwp_prof_stop(void);
+extern void lwp_prof_dump(FILE *out, tid_t tid);
+
+#endif
@@ -48,6 +48,7 @@
 #include <sys/time.h>
 #include "snakes.h"
 #include "lwp.h"
+#include "lwpsig.h"
 #include "util.h"
 
 #define MAXSNAKES  100
@@ -74,7 +75,7 @@ int main(int argc, char *argv[]){
     exit(err);
   }
 
-  install_handler(SIGINT, SIGINT_handler);   /* SIGINT will kill a snake */
+  lwp_signal_handle(SIGINT, SIGINT_handler); /* SIGINT will kill a snake */
   install_handler(SIGQUIT,SIGQUIT_handler);  /* SIGQUIT will end lwp     */
 
   /* wait to gdb  */
@@ -0,0 +1,331 @@
+#include "replay.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Summary: records and replays scheduling decisions. A decision is stored
+ * as the zigzag-encoded difference from the previous tid in LEB128, so the
+ * usual small hops between neighbouring tids cost one byte each.
+ *
+ * Replay installs a scheduler around the one in use. Admit and remove still
+ * go to the wrapped scheduler, so it stays correct to fall back on, but
+ * next() returns the thread the log names. If that thread is not runnable
+ * (the program took another path, or an offload finished at a different
+ * time) the run has diverged: the wrapped scheduler decides from then on
+ * and a warning is printed. tids come from a counter and are never reused,
+ * so the same program makes the same tids and the log lines up.
+ */
+
+int lwp_record_on = FALSE;
+
+static FILE *record_file = NULL;
+static tid_t record_prev = 0;
+static int record_atexit_done = FALSE;
+
+static scheduler inner = NULL;   /* the scheduler replay wraps      */
+static tid_t *replay_log = NULL; /* decisions, decoded              */
+static size_t replay_len = 0;
+static size_t replay_pos = 0;
+static int replay_ready = 0;     /* threads admitted and not removed */
+static unsigned long diverged = 0;
+
+/******************** Support Functions *******************/
+/*
+ * Description: reads one LEB128 varint
+ * Params: FILE *in and value out
+ * Return: TRUE if a whole varint was read
+ */
+static int read_varint(FILE *in, uint64_t *out)
+{
+    uint64_t v = 0;
+    int shift = 0, c;
+
+    while ((c = getc(in)) != EOF && shift < 64)
+    {
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+        {
+            *out = v;
+            return TRUE;
+        }
+        shift += 7;
+    }
+    return FALSE;
+}
+
+/*
+ * Description: thread the log names at a tid (0 is main)
+ * Params: tid_t tid
+ * Return: thread, NULL if it does not exist
+ */
+static thread replay_thread(tid_t tid)
+{
+    return tid == 0 ? main_thread : tid2thread(tid);
+}
+
+static void replay_admit(thread t)
+{
+    if (!(t->flags & LWP_REPLAY_READY))
+    {
+        t->flags |= LWP_REPLAY_READY;
+        replay_ready++;
+    }
+    inner->admit(t);
+}
+
+static void replay_remove(thread t)
+{
+    if (t->flags & LWP_REPLAY_READY)
+    {
+        t->flags &= ~LWP_REPLAY_READY;
+        replay_ready--;
+    }
+    inner->remove(t);
+}
+
+static void replay_admit_many(thread *ts, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (!(ts[i]->flags & LWP_REPLAY_READY))
+        {
+            ts[i]->flags |= LWP_REPLAY_READY;
+            replay_ready++;
+        }
+    }
+    lwp_sched_admit_many(inner, ts, n);
+}
+
+static void replay_remove_many(thread *ts, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (ts[i]->flags & LWP_REPLAY_READY)
+        {
+            ts[i]->flags &= ~LWP_REPLAY_READY;
+            replay_ready--;
+        }
+    }
+    lwp_sched_remove_many(inner, ts, n);
+}
+
+/*
+ * Description: empties the wrapped scheduler (lwp_set_scheduler() moving
+ * off replay). Goes straight to it, since the fallback's next() would
+ * consume the log.
+ * Params: array to fill and its size
+ * Return: number of threads taken
+ */
+static int replay_drain(thread *out, int n)
+{
+    int got = lwp_sched_drain(inner, out, n), i;
+
+    for (i = 0; i < got; i++)
+    {
+        out[i]->flags &= ~LWP_REPLAY_READY;
+    }
+    replay_ready -= got;
+    return got;
+}
+
+/*
+ * Description: next thread from the log, or from the wrapped scheduler
+ * once the run has diverged or the log is used up
+ * Params: void
+ * Return: thread to run, NULL if nothing is runnable
+ */
+static thread replay_next(void)
+{
+    thread t;
+
+    if (replay_ready == 0)
+    {
+        return NULL; /* not a decision: the recording never logged these */
+    }
+    if (diverged == 0 && replay_pos < replay_len)
+    {
+        t = replay_thread(replay_log[replay_pos]);
+        if (t != NULL && (t->flags & LWP_REPLAY_READY))
+        {
+            replay_pos++;
+            return t;
+        }
+        fprintf(stderr, "lwp_replay: diverged at decision %zu (tid %lu not runnable)\n",
+                replay_pos, replay_log[replay_pos]);
+    }
+    if (replay_pos < replay_len)
+    {
+        diverged++;
+    }
+    return inner->next();
+}
+
+static int replay_qlen(void)
+{
+    return replay_ready;
+}
+
+static struct scheduler replay_sched = {NULL, NULL, replay_admit, replay_remove, replay_next, replay_qlen,
+                                        replay_admit_many, replay_remove_many, replay_drain, "replay"};
+
+/******************** Main Functions *******************/
+/*
+ * Description: appends one decision to the record log
+ * Params: tid_t tid picked by sched->next()
+ * Return: void
+ */
+void record_next(tid_t tid)
+{
+    uint64_t v;
+    int64_t d = (int64_t)(tid - record_prev);
+
+    record_prev = tid;
+    v = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63); /* zigzag */
+    while (v >= 0x80)
+    {
+        putc((int)(v & 0x7f) | 0x80, record_file);
+        v >>= 7;
+    }
+    putc((int)v, record_file);
+}
+
+/*
+ * Description: starts logging every scheduling decision to a file.
+ * Recording stops (and the file is flushed) automatically at exit.
+ * Params: path of the log
+ * Return: 0 on success, -1 if the file can't be written
+ */
+int lwp_record_start(const char *path)
+{
+    replay_header hdr;
+
+    lwp_record_stop();
+
+    record_file = fopen(path, "wb");
+    if (record_file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, REPLAY_MAGIC, sizeof(hdr.magic));
+    hdr.version = REPLAY_VERSION;
+    fwrite(&hdr, sizeof(hdr), 1, record_file);
+
+    record_prev = 0;
+    lwp_record_on = TRUE;
+    if (!record_atexit_done)
+    {
+        atexit(lwp_record_stop);
+        record_atexit_done = TRUE;
+    }
+    return 0;
+}
+
+/*
+ * Description: stops recording and closes the log
+ * Params: void
+ * Return: void
+ */
+void lwp_record_stop(void)
+{
+    lwp_record_on = FALSE;
+    if (record_file != NULL)
+    {
+        fclose(record_file);
+        record_file = NULL;
+    }
+}
+
+/*
+ * Description: loads a recorded log and wraps the current scheduler so the
+ * decisions are replayed. Call before any decision the log covers, i.e.
+ * before lwp_start() (LWP_REPLAY=path does this from lwp_start()).
+ * Params: path of the log
+ * Return: number of decisions loaded, -1 on failure
+ */
+int lwp_replay_start(const char *path)
+{
+    replay_header hdr;
+    FILE *in;
+    uint64_t v;
+    size_t cap = 0;
+    tid_t tid = 0;
+    thread t;
+
+    in = fopen(path, "rb");
+    if (in == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, REPLAY_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != REPLAY_VERSION)
+    {
+        fprintf(stderr, "%s: not a version %d LWP schedule log\n", path, REPLAY_VERSION);
+        fclose(in);
+        return -1;
+    }
+
+    free(replay_log);
+    replay_log = NULL;
+    replay_len = 0;
+    while (read_varint(in, &v))
+    {
+        if (replay_len == cap)
+        {
+            cap = cap ? cap * 2 : 4096;
+            replay_log = realloc(replay_log, cap * sizeof(tid_t));
+            if (replay_log == NULL)
+            {
+                perror("lwp_replay_start");
+                exit(EXIT_FAILURE);
+            }
+        }
+        tid += (tid_t)((v >> 1) ^ -(v & 1)); /* undo zigzag */
+        replay_log[replay_len++] = tid;
+    }
+    fclose(in);
+    replay_pos = 0;
+    diverged = 0;
+
+    /* every pick has to come from the log, runnext ones included */
+    lwp_runnext_enable(FALSE);
+
+    /* wrap whatever is installed; threads admitted so far are already in it */
+    if (lwp_get_scheduler() != &replay_sched)
+    {
+        inner = lwp_get_scheduler();
+        replay_ready = 0;
+        if (main_thread != NULL && main_thread->wait_reason == LWP_BLOCK_NONE)
+        {
+            main_thread->flags |= LWP_REPLAY_READY;
+            replay_ready++;
+        }
+        for (t = thread_internal; t != NULL; t = t->lib_one)
+        {
+            if (!LWPTERMINATED(t->status) && t->wait_reason == LWP_BLOCK_NONE)
+            {
+                t->flags |= LWP_REPLAY_READY;
+                replay_ready++;
+            }
+        }
+        sched = &replay_sched;
+    }
+    return replay_len;
+}
+
+/*
+ * Description: how many decisions could not be replayed from the log
+ * Params: void
+ * Return: 0 if the replay has matched the recording so far
+ */
+unsigned long lwp_replay_diverged(void)
+{
+    return diverged;
+}
@@ -0,0 +1,35 @@
+#ifndef REPLAYH
+#define REPLAYH
+#include <stdint.h>
+#include "lwp.h"
+
+/* schedule record/replay: record mode logs the tid every sched->next()
+ * picks; replay mode wraps the scheduler so next() hands out the logged
+ * tids in the same order, reproducing an interleaving run after run */
+
+#define REPLAY_MAGIC "LWPSCHED"
+#define REPLAY_VERSION 1
+
+typedef struct replay_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+} replay_header;
+
+extern int lwp_record_on;
+extern int lwp_record_start(const char *path);
+extern void lwp_record_stop(void);
+extern int lwp_replay_start(const char *path);
+extern unsigned long lwp_replay_diverged(void);
+
+/* hook for lwp.c: log one scheduling decision */
+#define RECORD_NEXT(t)                                                         \
+  do                                                                           \
+  {                                                                            \
+    if (lwp_record_on)                                                         \
+      record_next((t)->tid);                                                   \
+  } while (0)
+extern void record_next(tid_t tid);
+
+#endif
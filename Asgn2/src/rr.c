@@ -1,15 +1,16 @@
-#include "lwp.h"
+#include "rr.h"
 #include <stdlib.h>
 #include <stdio.h>
 
 /*
  * Summary: scheduler manipulates a doubly linked list by maintaining a
- * queue of threads to be executed. Top of queue is next to be run
+ * queue of threads to be executed. Top of queue is next to be run. The
+ * single-thread operations live in rr.h so lwp.c can inline them.
  */
 
-thread head = NULL;
-thread tail = NULL;
-int length = 0;
+thread rr_head = NULL;
+thread rr_tail = NULL;
+int rr_length = 0;
 
 /*
  * Description: adds new thread to end of queue
@@ -18,109 +19,108 @@ int length = 0;
  */
 void rr_admit(thread new)
 {
-    if (head == NULL && tail == NULL)
-    {
-        head = new;
-        tail = new;
-        length++;
-        return;
-    }
-
-    // add to end of queue
-    tail->next = new;
-    new->prev = tail;
-    tail = new;
-    length++;
+    rr_admit_inline(new);
 }
 
 /*
- * Description: removes victim thread from queue
+ * Description: removes victim thread from queue, if it is queued
  * Params: victim thread
  * Return: void
  */
 void rr_remove(thread victim)
 {
-    /* begin searching for victim starting at tail */
-    thread temp = tail;
-    while (temp != NULL && temp->tid != victim->tid)
+    rr_remove_inline(victim);
+}
+
+/*
+ * Description: returns top of queue as the next thread to be executed and
+ * rotates it to the end for RR
+ * Params: void
+ * Return: thread to be next ran
+ */
+thread rr_next(void)
+{
+    return rr_next_inline();
+}
+
+int rr_qlen(void)
+{
+    return rr_length;
+}
+
+/*
+ * Description: adds threads to the end of queue, in order
+ * Params: threads and how many
+ * Return: void
+ */
+void rr_admit_many(thread *threads, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
     {
-        temp = temp->prev;
-        length--;
+        threads[i]->next = i + 1 < n ? threads[i + 1] : NULL;
+        threads[i]->prev = i > 0 ? threads[i - 1] : rr_tail;
     }
-
-    /* if tail is NULL or no victim found */
-    if (temp == NULL || temp->tid != temp->tid)
+    if (n == 0)
     {
         return;
     }
 
-    /* victim found (aka temp) so remove temp (doubly linked list so set BOTH 'next' and 'prev' pointer for each node) */
-    // setting next pointer
-    if (temp->prev != NULL)
+    // splice the chain on after rr_tail
+    if (rr_tail == NULL)
     {
-        // set 'next' pointer for thread initally pointing to victim to now point to thread after victim
-        temp->prev->next = temp->next;
+        rr_head = threads[0];
     }
     else
     {
-        // no thread before victim so thread after victim is head
-        head = temp->next;
-    }
-    // set previous pointer
-    if (temp->next != NULL)
-    {
-        // set 'prev' pointer for thread initially pointing to victim to now point thread before victim
-        temp->next->prev = temp->prev;
+        rr_tail->next = threads[0];
     }
-    else
+    rr_tail = threads[n - 1];
+    rr_length += n;
+}
+
+/*
+ * Description: removes each of the victims from queue
+ * Params: victim threads and how many
+ * Return: void
+ */
+void rr_remove_many(thread *victims, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
     {
-        // no thread after victim so thread before victim is tail
-        tail = temp->prev;
+        rr_remove_inline(victims[i]);
     }
 }
 
 /*
- * Description: dequeues top of queue for next thread to be executed and resscheules that thread for RR
- * Params: void
- * Return: thread to be next ran
+ * Description: takes threads off the top of queue, in run order
+ * Params: array to fill and its size
+ * Return: number of threads taken
  */
-thread rr_next(void)
+int rr_drain(thread *out, int n)
 {
-    thread thread_to_run;
+    int i;
 
-    /* no threads to run if head is null */
-    if (head == NULL)
+    for (i = 0; i < n && rr_head != NULL; i++)
     {
-        return NULL;
+        out[i] = rr_head;
+        rr_head = rr_head->next;
+        out[i]->next = NULL;
+        out[i]->prev = NULL;
     }
-
-    /* dequeue first in queue to return as next thread to run */
-    thread_to_run = head;
-    head = head->next;
-    if (head != NULL)
+    if (rr_head != NULL)
     {
-        // ensure second thread in queue 'prev' pointer does not point back to former head (aka thread_to_run)
-        head->prev = NULL;
+        rr_head->prev = NULL;
     }
     else
     {
-        // thread_to_run was last thread so both head and tail should be NULL
-        tail = NULL;
+        rr_tail = NULL;
     }
-
-    /* reset thread_to_run position pointers */
-    thread_to_run->next = NULL;
-    thread_to_run->prev = NULL;
-
-    /* cycle dequeued thread to end of queue for RR */
-    rr_admit(thread_to_run);
-
-    return thread_to_run;
-}
-
-int rr_qlen(void)
-{
-    return length;
+    rr_length -= i;
+    return i;
 }
 
 void rr_init(void)
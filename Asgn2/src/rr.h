@@ -0,0 +1,81 @@
+#ifndef RRH
+#define RRH
+#include <stddef.h>
+#include "lwp.h"
+
+/* round robin queue operations, inline so a build that binds round robin
+ * statically (-DLWP_STATIC_RR) can compile them into lwp.c's switch path.
+ * rr.c wraps them as rr_admit/rr_remove/rr_next for the scheduler table.
+ * The queue is a doubly linked list through next/prev; top of queue runs
+ * next and the running thread stays queued. */
+
+extern thread rr_head;
+extern thread rr_tail;
+extern int rr_length;
+
+/* adds a thread to the end of queue */
+static inline void rr_admit_inline(thread new)
+{
+  /* a re-admitted thread may still carry links from its last stay */
+  new->next = NULL;
+  new->prev = rr_tail;
+  if (rr_tail == NULL)
+  {
+    rr_head = new;
+  }
+  else
+  {
+    rr_tail->next = new;
+  }
+  rr_tail = new;
+  rr_length++;
+}
+
+/* removes a thread if it is queued. Threads off the queue have no links,
+ * so a thread with no prev is queued only if it is the head. */
+static inline void rr_remove_inline(thread victim)
+{
+  if (victim->prev == NULL && rr_head != victim)
+  {
+    return;
+  }
+  if (victim->prev != NULL)
+  {
+    victim->prev->next = victim->next;
+  }
+  else
+  {
+    rr_head = victim->next;
+  }
+  if (victim->next != NULL)
+  {
+    victim->next->prev = victim->prev;
+  }
+  else
+  {
+    rr_tail = victim->prev;
+  }
+  victim->next = NULL;
+  victim->prev = NULL;
+  rr_length--;
+}
+
+/* picks the top of queue and rotates it to the end */
+static inline thread rr_next_inline(void)
+{
+  thread t = rr_head;
+
+  if (t == NULL || t == rr_tail)
+  {
+    return t; /* zero or one thread: nothing to rotate */
+  }
+  rr_head = t->next;
+  rr_head->prev = NULL;
+  t->next = NULL;
+  t->prev = rr_tail;
+  rr_tail->next = t;
+  rr_tail = t;
+  return t;
+}
+
+#endif
@@ -0,0 +1,450 @@
+#include "schedulers.h"
+#include "snakes.h"
+#include "lwpsig.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+
+/*
+ * Summary: the schedulers named in schedulers.h, for the snake demos.
+ *
+ * AlwaysZero always runs the longest-waiting runnable thread (the head of
+ * a FIFO, which is not rotated), so one thread runs until it blocks or
+ * exits. ChangeOnSIGTSTP does the same, except that each SIGTSTP sends
+ * the running thread to the back of the line. The signal is taken through
+ * lwp_signal_handle(), so the rotation happens at the next switch, in LWP
+ * context, one O(1) rotate per signal.
+ *
+ * ChooseHighestColor and ChooseLowestColor run the snakes of the highest
+ * (lowest) color present, round robin within that color. Threads sit in a
+ * FIFO per color with a bitmap of the non-empty ones, so a decision is a
+ * bit scan and a rotate instead of two passes over every thread. Threads
+ * that aren't snakes (main, helpers) share class 0 and take every other
+ * turn, so they can't be starved by the snakes. Colors change while a
+ * snake is queued (hungry snakes change color as they eat), so next()
+ * re-reads the color of the thread it is about to pick and moves it to
+ * the right queue if it has changed. Each thread's snake is cached in its
+ * sched_data, so that is one load, not a snakeFromLWpid() per pick.
+ *
+ * Like rr.c, the running thread stays queued; threads are linked through
+ * sched_one/sched_two.
+ */
+
+#define COLOR_CLASSES 16 /* class 0 is "not a snake", then colors 1..15 */
+
+typedef struct color_queue
+{
+    thread head;
+    thread tail;
+} color_queue;
+
+typedef struct fifo
+{
+    color_queue q;
+    int len;
+} fifo;
+
+static fifo zero_q = {{NULL, NULL}, 0}; /* AlwaysZero      */
+static fifo tstp_q = {{NULL, NULL}, 0}; /* ChangeOnSIGTSTP */
+
+/* color schedulers (only one is ever installed at a time) */
+static color_queue color_q[COLOR_CLASSES];
+static uint32_t color_mask = 0; /* bit c set when color_q[c] is not empty */
+static int color_len = 0;
+static int others_turn = FALSE; /* class 0 goes next */
+
+/* sched_data: the thread's snake, NULL if not looked up yet, or one of */
+static char has_run, not_a_snake;
+#define HAS_RUN ((void *)&has_run)         /* not a snake as of its last pick */
+#define NOT_A_SNAKE ((void *)&not_a_snake) /* not a snake, for good           */
+
+/******************** Support Functions *******************/
+/*
+ * Description: appends a thread to a queue
+ * Params: color_queue *q and thread t
+ * Return: void
+ */
+static void queue_push(color_queue *q, thread t)
+{
+    t->sched_one = NULL;
+    t->sched_two = q->tail;
+    if (q->tail == NULL)
+    {
+        q->head = t;
+    }
+    else
+    {
+        q->tail->sched_one = t;
+    }
+    q->tail = t;
+}
+
+/*
+ * Description: unlinks a thread known to be on a queue
+ * Params: color_queue *q and thread t
+ * Return: void
+ */
+static void queue_unlink(color_queue *q, thread t)
+{
+    if (t->sched_two != NULL)
+    {
+        t->sched_two->sched_one = t->sched_one;
+    }
+    else
+    {
+        q->head = t->sched_one;
+    }
+    if (t->sched_one != NULL)
+    {
+        t->sched_one->sched_two = t->sched_two;
+    }
+    else
+    {
+        q->tail = t->sched_two;
+    }
+    t->sched_one = NULL;
+    t->sched_two = NULL;
+}
+
+/*
+ * Description: scheduling class of a thread: its snake's color, or 0. A
+ * snake registers its tid when its LWP first runs, so a miss is only
+ * final once the thread has been picked and has run since (HAS_RUN);
+ * after that it costs nothing.
+ * Params: thread t
+ * Return: 0..COLOR_CLASSES-1
+ */
+static int color_of(thread t)
+{
+    snake s;
+
+    if (t->sched_data == NOT_A_SNAKE)
+    {
+        return 0;
+    }
+    if (t->sched_data == NULL || t->sched_data == HAS_RUN)
+    {
+        s = snakeFromLWpid(t->tid);
+        if (s == NULL)
+        {
+            if (t->sched_data == HAS_RUN)
+            {
+                t->sched_data = NOT_A_SNAKE;
+            }
+            return 0;
+        }
+        t->sched_data = s;
+    }
+    s = t->sched_data;
+    if (s->color <= 0)
+    {
+        return 0;
+    }
+    return s->color < COLOR_CLASSES ? s->color : COLOR_CLASSES - 1;
+}
+
+/*
+ * Description: queues a thread in a class
+ * Params: thread t and class c
+ * Return: void
+ */
+static void color_push(thread t, int c)
+{
+    queue_push(&color_q[c], t);
+    color_mask |= 1u << c;
+}
+
+/*
+ * Description: unlinks a thread from class c
+ * Params: thread t and class c
+ * Return: void
+ */
+static void color_unlink(thread t, int c)
+{
+    queue_unlink(&color_q[c], t);
+    if (color_q[c].head == NULL)
+    {
+        color_mask &= ~(1u << c);
+    }
+}
+
+/*
+ * Description: picks from the highest or lowest non-empty color, or class
+ * 0 on its turn, and rotates the pick to the back of its queue
+ * Params: TRUE for the highest color
+ * Return: thread to run, NULL if none
+ */
+static thread color_next(int highest)
+{
+    uint32_t colors;
+    thread t;
+    int c, now, sweep = FALSE;
+
+    for (;;)
+    {
+        colors = color_mask & ~1u;
+        if ((color_mask & 1u) && (sweep || others_turn || colors == 0))
+        {
+            c = 0;
+        }
+        else if (colors != 0)
+        {
+            c = highest ? 31 - __builtin_clz(colors) : __builtin_ctz(colors);
+        }
+        else
+        {
+            return NULL;
+        }
+
+        t = color_q[c].head;
+        now = color_of(t);
+        color_unlink(t, c);
+        color_push(t, now);
+        if (now == c)
+        {
+            others_turn = (c != 0);
+            if (t->sched_data == NULL)
+            {
+                t->sched_data = HAS_RUN;
+            }
+            return t;
+        }
+        /* recolored since it was queued: it's in the right queue now, look
+         * again. Snakes are admitted before they register their tid, so new
+         * ones start out in class 0; sweep those out before choosing a
+         * color. */
+        sweep = (c == 0);
+    }
+}
+
+/******************** AlwaysZero and ChangeOnSIGTSTP *******************/
+/*
+ * Description: removes a thread from a FIFO if it is queued there
+ * Params: fifo *q and victim thread
+ * Return: void
+ */
+static void fifo_remove(fifo *q, thread victim)
+{
+    if (victim->sched_two == NULL && q->q.head != victim)
+    {
+        return;
+    }
+    queue_unlink(&q->q, victim);
+    q->len--;
+}
+
+/*
+ * Description: takes threads off the front of a FIFO
+ * Params: fifo *q, array to fill and its size
+ * Return: number of threads taken
+ */
+static int fifo_drain(fifo *q, thread *out, int n)
+{
+    int i;
+
+    for (i = 0; i < n && q->q.head != NULL; i++)
+    {
+        out[i] = q->q.head;
+        queue_unlink(&q->q, out[i]);
+    }
+    q->len -= i;
+    return i;
+}
+
+static void zero_init(void)
+{
+    zero_q.q.head = NULL;
+    zero_q.q.tail = NULL;
+    zero_q.len = 0;
+}
+
+static void zero_admit(thread new)
+{
+    queue_push(&zero_q.q, new);
+    zero_q.len++;
+}
+
+static void zero_remove(thread victim)
+{
+    fifo_remove(&zero_q, victim);
+}
+
+static thread zero_next(void)
+{
+    return zero_q.q.head;
+}
+
+static int zero_qlen(void)
+{
+    return zero_q.len;
+}
+
+static int zero_drain(thread *out, int n)
+{
+    return fifo_drain(&zero_q, out, n);
+}
+
+/*
+ * Description: deferred SIGTSTP callback: moves the running thread (the
+ * head) to the back, so the next one runs from the next switch on. It runs
+ * while the switching thread is still thread_curr; if that one is leaving
+ * the queue (exit, block) the head is already its successor, which must
+ * keep its turn.
+ * Params: signal number
+ * Return: void
+ */
+static void tstp_rotate(int sig)
+{
+    thread t = tstp_q.q.head;
+
+    if (t != NULL && t == thread_curr && t != tstp_q.q.tail)
+    {
+        queue_unlink(&tstp_q.q, t);
+        queue_push(&tstp_q.q, t);
+    }
+}
+
+static void tstp_init(void)
+{
+    tstp_q.q.head = NULL;
+    tstp_q.q.tail = NULL;
+    tstp_q.len = 0;
+    lwp_signal_handle(SIGTSTP, tstp_rotate);
+}
+
+static void tstp_shutdown(void)
+{
+    lwp_signal_handle(SIGTSTP, NULL);
+}
+
+static void tstp_admit(thread new)
+{
+    queue_push(&tstp_q.q, new);
+    tstp_q.len++;
+}
+
+static void tstp_remove(thread victim)
+{
+    fifo_remove(&tstp_q, victim);
+}
+
+static thread tstp_next(void)
+{
+    return tstp_q.q.head;
+}
+
+static int tstp_qlen(void)
+{
+    return tstp_q.len;
+}
+
+static int tstp_drain(thread *out, int n)
+{
+    return fifo_drain(&tstp_q, out, n);
+}
+
+/******************** Color schedulers *******************/
+static void color_init(void)
+{
+    int c;
+
+    for (c = 0; c < COLOR_CLASSES; c++)
+    {
+        color_q[c].head = NULL;
+        color_q[c].tail = NULL;
+    }
+    color_mask = 0;
+    color_len = 0;
+    others_turn = FALSE;
+}
+
+static void color_admit(thread new)
+{
+    color_push(new, color_of(new));
+    color_len++;
+}
+
+/*
+ * Description: removes a thread if it is queued. A thread with no
+ * predecessor is the head of one of the queues; which one is found by
+ * checking the (at most COLOR_CLASSES) non-empty heads.
+ * Params: victim thread
+ * Return: void
+ */
+static void color_remove(thread victim)
+{
+    uint32_t m;
+    int c = -1;
+
+    for (m = color_mask; m != 0; m &= m - 1)
+    {
+        if (victim->sched_two == NULL ? color_q[__builtin_ctz(m)].head == victim
+                                      : color_q[__builtin_ctz(m)].tail == victim)
+        {
+            c = __builtin_ctz(m);
+            break;
+        }
+    }
+    if (c >= 0)
+    {
+        color_unlink(victim, c);
+        color_len--;
+    }
+    else if (victim->sched_two != NULL)
+    {
+        /* in the middle of some queue, so neither end moves */
+        queue_unlink(&color_q[0], victim);
+        color_len--;
+    }
+}
+
+static thread highest_next(void)
+{
+    return color_next(TRUE);
+}
+
+static thread lowest_next(void)
+{
+    return color_next(FALSE);
+}
+
+static int color_qlen(void)
+{
+    return color_len;
+}
+
+/*
+ * Description: empties the queues one class at a time, lowest first.
+ * Going through next() instead would re-read every thread's color.
+ * Params: array to fill and its size
+ * Return: number of threads taken
+ */
+static int color_drain(thread *out, int n)
+{
+    int i, c;
+
+    for (i = 0; i < n && color_mask != 0; i++)
+    {
+        c = __builtin_ctz(color_mask);
+        out[i] = color_q[c].head;
+        color_unlink(out[i], c);
+    }
+    color_len -= i;
+    return i;
+}
+
+/******************** Main Functions *******************/
+static struct scheduler always_zero = {zero_init, NULL, zero_admit, zero_remove, zero_next, zero_qlen,
+                                       NULL, NULL, zero_drain, "AlwaysZero"};
+static struct scheduler change_on_sigtstp = {tstp_init, tstp_shutdown, tstp_admit, tstp_remove, tstp_next, tstp_qlen,
+                                             NULL, NULL, tstp_drain, "ChangeOnSIGTSTP"};
+static struct scheduler choose_highest = {color_init, NULL, color_admit, color_remove, highest_next, color_qlen,
+                                          NULL, NULL, color_drain, "ChooseHighestColor"};
+static struct scheduler choose_lowest = {color_init, NULL, color_admit, color_remove, lowest_next, color_qlen,
+                                         NULL, NULL, color_drain, "ChooseLowestColor"};
+
+scheduler AlwaysZero = &always_zero;
+scheduler ChangeOnSIGTSTP = &change_on_sigtstp;
+scheduler ChooseHighestColor = &choose_highest;
+scheduler ChooseLowestColor = &choose_lowest;
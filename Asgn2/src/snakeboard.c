@@ -0,0 +1,44 @@
+#include "snakeboard.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+/*
+ * Summary: the board shared by the snake programs. It is only a grid of
+ * owner ids; moving a snake is two stores (claim the new head cell, clear
+ * the old tail cell), so collision tests stay O(1) as snakes get longer
+ * and more numerous.
+ */
+
+/* same order as the direction enum: NW, N, NE, W, E, SW, S, SE */
+const int board_dx[NUMDIRS] = {-1, 0, 1, -1, 1, -1, 0, 1};
+const int board_dy[NUMDIRS] = {-1, -1, -1, 0, 0, 1, 1, 1};
+
+/*
+ * Description: allocates an empty board
+ * Params: board *b, rows and cols
+ * Return: 0 on success, -1 if out of memory
+ */
+int board_init(board *b, int rows, int cols)
+{
+    b->rows = rows;
+    b->cols = cols;
+    b->dirty = NULL;
+    b->cell = calloc((size_t)rows * cols, sizeof(uint32_t));
+    if (b->cell == NULL)
+    {
+        perror("board_init");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Description: releases a board
+ * Params: board *b
+ * Return: void
+ */
+void board_free(board *b)
+{
+    free(b->cell);
+    b->cell = NULL;
+}
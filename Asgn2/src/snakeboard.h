@@ -0,0 +1,49 @@
+#ifndef SNAKEBOARDH
+#define SNAKEBOARDH
+#include <stddef.h>
+#include <stdint.h>
+#include "snakes.h"
+
+/* in-memory snake board: one owner id per cell (0 is empty), so "is this
+ * cell taken" and "whose is it" are a single load however many snakes
+ * there are. Cells outside the board count as taken (walls). While a
+ * renderer is attached every change also sets the cell's dirty bit. */
+
+#define BOARD_EMPTY 0
+
+typedef struct board
+{
+  int rows;
+  int cols;
+  uint32_t *cell;  /* rows * cols owner ids, row major      */
+  uint64_t *dirty; /* one bit per cell, NULL if not drawn    */
+} board;
+
+extern const int board_dx[NUMDIRS]; /* step for each direction */
+extern const int board_dy[NUMDIRS];
+
+extern int board_init(board *b, int rows, int cols);
+extern void board_free(board *b);
+
+/* owner of a cell, or (uint32_t)-1 off the board */
+static inline uint32_t board_get(const board *b, int y, int x)
+{
+  if (y < 0 || y >= b->rows || x < 0 || x >= b->cols)
+  {
+    return (uint32_t)-1;
+  }
+  return b->cell[(size_t)y * b->cols + x];
+}
+
+static inline void board_set(board *b, int y, int x, uint32_t owner)
+{
+  size_t i = (size_t)y * b->cols + x;
+
+  b->cell[i] = owner;
+  if (b->dirty != NULL)
+  {
+    b->dirty[i / 64] |= 1ull << (i % 64);
+  }
+}
+
+#endif
@@ -0,0 +1,209 @@
+#include "snakerender.h"
+#include "lwpsleep.h"
+#include "tsc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ncurses.h>
+
+/*
+ * Summary: draws a snake board through a dirty bitmap. Snakes only flip
+ * bits as they move; render_flush() walks the bitmap a word at a time
+ * (clean words cost one compare), draws each changed cell once however
+ * often it changed during the tick, and does a single refresh(). The
+ * renderer LWP flushes every tick and sleeps in lwp_sleep_ns() in
+ * between, so drawing costs one write burst per tick rather than one per
+ * snake step.
+ *
+ * Code that draws with curses directly (the snakes demos) has no board
+ * attached; curses' own screen is the dirty map, and render_tick() from
+ * the drawing LWP does the once-per-tick refresh(). That needs no
+ * renderer LWP, which schedulers that run one snake until it exits
+ * (AlwaysZero) would never get to.
+ */
+
+static board *rboard = NULL;
+static render_colorfun rcolor = NULL;
+static render_stats rstats;
+static int rtick_ms = RENDER_DEFAULT_TICK_MS;
+static int rstopping = FALSE;
+static tid_t rtid = NO_THREAD;
+static uint64_t rlast = 0; /* tsc_now() at the last frame */
+
+/******************** Support Functions *******************/
+/*
+ * Description: draws one cell
+ * Params: cell index
+ * Return: void
+ */
+static void draw_cell(size_t i)
+{
+    int y = i / rboard->cols, x = i % rboard->cols;
+    uint32_t owner = rboard->cell[i];
+    int pair;
+
+    if (y >= LINES || x >= COLS)
+    {
+        rstats.skipped++;
+        return;
+    }
+    if (owner == BOARD_EMPTY)
+    {
+        mvaddch(y, x, ' ');
+    }
+    else
+    {
+        pair = rcolor != NULL ? rcolor(owner) : 0;
+        mvaddch(y, x, RENDER_GLYPH | COLOR_PAIR(pair));
+    }
+    rstats.cells++;
+}
+
+/*
+ * Description: renderer LWP body: flush every tick until render_stop()
+ * Params: unused
+ * Return: 0
+ */
+static int renderer(void *unused)
+{
+    while (!rstopping)
+    {
+        render_flush();
+        lwp_sleep_ns(rtick_ms * 1000000ull);
+    }
+    render_flush();
+    return 0;
+}
+
+/******************** Main Functions *******************/
+/*
+ * Description: attaches a dirty bitmap to a board, with every cell dirty
+ * so the first flush draws the whole board
+ * Params: board and the color pair for an owner (NULL for pair 0)
+ * Return: 0 on success, -1 if out of memory
+ */
+int render_init(board *b, render_colorfun color_of)
+{
+    size_t words = ((size_t)b->rows * b->cols + 63) / 64;
+
+    b->dirty = malloc(words * sizeof(uint64_t));
+    if (b->dirty == NULL)
+    {
+        perror("render_init");
+        return -1;
+    }
+    memset(b->dirty, 0xff, words * sizeof(uint64_t));
+    rboard = b;
+    rcolor = color_of;
+    memset(&rstats, 0, sizeof(rstats));
+    return 0;
+}
+
+/*
+ * Description: detaches and frees the dirty bitmap
+ * Params: void
+ * Return: void
+ */
+void render_free(void)
+{
+    if (rboard != NULL)
+    {
+        free(rboard->dirty);
+        rboard->dirty = NULL;
+        rboard = NULL;
+    }
+}
+
+/*
+ * Description: draws every dirty cell and refreshes once; with no board
+ * attached, just refreshes what was drawn since the last frame
+ * Params: void
+ * Return: void
+ */
+void render_flush(void)
+{
+    size_t cells, words, w, i;
+    uint64_t bits;
+
+    rlast = tsc_now();
+    if (rboard == NULL)
+    {
+        refresh();
+        rstats.ticks++;
+        return;
+    }
+    cells = (size_t)rboard->rows * rboard->cols;
+    words = (cells + 63) / 64;
+    for (w = 0; w < words; w++)
+    {
+        bits = rboard->dirty[w];
+        if (bits == 0)
+        {
+            continue;
+        }
+        rboard->dirty[w] = 0;
+        while (bits != 0)
+        {
+            i = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (i < cells)
+            {
+                draw_cell(i);
+            }
+        }
+    }
+    refresh();
+    rstats.ticks++;
+}
+
+/*
+ * Description: render_flush() if a tick has passed since the last frame,
+ * for drawing LWPs that refresh the screen themselves
+ * Params: void
+ * Return: void
+ */
+void render_tick(void)
+{
+    if (tsc_to_ns(tsc_now() - rlast) >= (uint64_t)rtick_ms * 1000000)
+    {
+        render_flush();
+    }
+}
+
+/*
+ * Description: starts the renderer LWP
+ * Params: milliseconds between frames (<= 0 for the default)
+ * Return: its tid, or (tid_t)-1 if it could not be created
+ */
+tid_t render_start(int tick_ms)
+{
+    rtick_ms = tick_ms > 0 ? tick_ms : RENDER_DEFAULT_TICK_MS;
+    rstopping = FALSE;
+    rtid = lwp_create(renderer, NULL);
+    return rtid;
+}
+
+/*
+ * Description: stops the renderer after one last frame and waits for it
+ * Params: void
+ * Return: void
+ */
+void render_stop(void)
+{
+    if (rtid != NO_THREAD && rtid != (tid_t)-1)
+    {
+        rstopping = TRUE;
+        lwp_join(rtid, NULL);
+        rtid = NO_THREAD;
+    }
+}
+
+/*
+ * Description: copies out the frame counters
+ * Params: render_stats *out
+ * Return: void
+ */
+void render_get_stats(render_stats *out)
+{
+    *out = rstats;
+}
@@ -0,0 +1,34 @@
+#ifndef SNAKERENDERH
+#define SNAKERENDERH
+#include <stdint.h>
+#include "lwp.h"
+#include "snakeboard.h"
+
+/* incremental curses rendering for a snake board: board_set() marks cells
+ * dirty, and a renderer LWP draws just those cells and calls refresh()
+ * once per tick, instead of every snake redrawing and refreshing on every
+ * step. Code drawing with curses itself can call render_tick() after each
+ * step instead, for the same one refresh() per tick. The caller owns
+ * curses setup (initscr, colors) and teardown. */
+
+#define RENDER_DEFAULT_TICK_MS 50
+#define RENDER_GLYPH 'o'
+
+typedef int (*render_colorfun)(uint32_t owner); /* color pair for a cell */
+
+typedef struct render_stats
+{
+  unsigned long ticks;   /* refresh() calls            */
+  unsigned long cells;   /* cells drawn                */
+  unsigned long skipped; /* dirty cells off the screen */
+} render_stats;
+
+extern int render_init(board *b, render_colorfun color_of);
+extern void render_free(void);
+extern void render_flush(void);
+extern void render_tick(void);
+extern tid_t render_start(int tick_ms);
+extern void render_stop(void);
+extern void render_get_stats(render_stats *out);
+
+#endif
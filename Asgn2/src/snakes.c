@@ -0,0 +1,633 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <ncurses.h>
+#include "snakes.h"
+#include "snakeboard.h"
+#include "snakerender.h"
+
+/*
+ * Summary: the curses snakes used by the snakes and hungry demos. Every
+ * snake still sits on the allsnakes list, but two indexes keep the hot
+ * paths from walking it:
+ *  - an occupancy grid (a snakeboard holding, per cell, how many body
+ *    segments cover it) that each move updates incrementally (the new head
+ *    goes in, the old tail comes out), so "is this cell free" is one load
+ *    however many and however long the snakes are;
+ *  - a hash table keyed by lw_pid for snakeFromLWpid(), which the color
+ *    schedulers call for every thread. lw_pid is only filled in by the
+ *    caller after lwp_create(), so a snake registers itself with
+ *    lwp_gettid() when its LWP starts running; lookups (hits and misses,
+ *    e.g. main or helper LWPs) are a walk of one short chain. tids are
+ *    handed out in order, so with twice as many slots as snakes most
+ *    chains hold one snake or none.
+ * Moves also redraw just the three cells that changed instead of the
+ * whole snake, and the screen is refreshed through render_tick(), once
+ * per RENDER_DEFAULT_TICK_MS however many snakes moved, not once a step.
+ */
+
+#define SNAKE_BODY_CHAR '*'
+#define SNAKE_FOOD_CHAR 'X'
+#define SNAKE_FOOD_COLOR 7
+#define SNAKE_DEFAULT_DELAY 10 /* ms between moves */
+#define SNAKE_INDEX_MIN 64
+
+snake allsnakes = NULL;
+
+static int rows = 0; /* screen size, set by start_windowing() */
+static int cols = 0;
+static int colored = FALSE;
+static int endsnake = FALSE; /* set by kill_snake(), taken by the next snake to move */
+static unsigned int snake_delay = SNAKE_DEFAULT_DELAY;
+static sn_point food = {-1, -1};
+
+static board grid;          /* body segments per cell */
+static size_t occupied = 0; /* cells with at least one segment */
+static snake *snake_index = NULL; /* lw_pid -> snake, chained through tid_next */
+static size_t snake_index_size = 0;
+static size_t snake_index_cnt = 0; /* snakes registered in it */
+
+/* what the head looks like going each way (same order as direction) */
+static const chtype head_char[NUMDIRS] = {'<', '^', '>', '<', '>', '<', 'v', '>'};
+
+/* direction toward the food, indexed by (sign dy + 1) * 3 + (sign dx + 1) */
+static const direction toward[9] = {NW, N, NE, W, N, E, SW, S, SE};
+
+/******************** Support Functions *******************/
+/*
+ * Description: clamps a value into [0, hi - 1]
+ * Params: value and bound
+ * Return: clamped value
+ */
+static int clamp(int v, int hi)
+{
+    if (v >= hi)
+    {
+        v = hi - 1;
+    }
+    return v < 0 ? 0 : v;
+}
+
+/*
+ * Description: whether a cell is off the screen or under some snake
+ * Params: sn_point p
+ * Return: TRUE if a snake can't move there
+ */
+static int obstructed(sn_point p)
+{
+    return board_get(&grid, p.y, p.x) != BOARD_EMPTY;
+}
+
+/*
+ * Description: adds or removes one body segment on a cell, keeping count
+ * of the cells that are covered
+ * Params: sn_point p and +1 or -1
+ * Return: segments left on the cell
+ */
+static uint32_t occupy(sn_point p, int delta)
+{
+    uint32_t n = board_get(&grid, p.y, p.x);
+
+    if (n == (uint32_t)-1)
+    {
+        return 0; /* off the board (or no board yet) */
+    }
+    n += delta;
+    if (n == 1 && delta > 0)
+    {
+        occupied++;
+    }
+    else if (n == 0)
+    {
+        occupied--;
+    }
+    board_set(&grid, p.y, p.x, n);
+    return n;
+}
+
+/*
+ * Description: draws one body cell
+ * Params: snake s and segment index (0 is the head)
+ * Return: void
+ */
+static void draw_segment(snake s, int i)
+{
+    chtype c;
+
+    if (i == 0)
+    {
+        c = head_char[s->dir];
+    }
+    else
+    {
+        c = colored ? SNAKE_BODY_CHAR : '0' + s->color;
+    }
+    if (colored)
+    {
+        c |= COLOR_PAIR(s->color);
+    }
+    mvaddch(s->body[i].y, s->body[i].x, c);
+}
+
+/*
+ * Description: doubles the lw_pid table (or makes the first one), moving
+ * the chains over
+ * Params: void
+ * Return: void
+ */
+static void index_grow(void)
+{
+    size_t size = snake_index_size ? 2 * snake_index_size : SNAKE_INDEX_MIN, i, slot;
+    snake *table, s, next;
+
+    table = calloc(size, sizeof(snake));
+    if (table == NULL)
+    {
+        return; /* keep the old one; the chains just get longer */
+    }
+    for (i = 0; i < snake_index_size; i++)
+    {
+        for (s = snake_index[i]; s != NULL; s = next)
+        {
+            next = s->tid_next;
+            slot = s->lw_pid & (size - 1);
+            s->tid_next = table[slot];
+            table[slot] = s;
+        }
+    }
+    free(snake_index);
+    snake_index = table;
+    snake_index_size = size;
+}
+
+/*
+ * Description: registers a snake under the tid of the LWP running it
+ * Params: snake s
+ * Return: void
+ */
+static void index_add(snake s)
+{
+    size_t slot;
+
+    s->lw_pid = lwp_gettid();
+    if (2 * (snake_index_cnt + 1) > snake_index_size)
+    {
+        index_grow();
+    }
+    if (snake_index_size == 0)
+    {
+        return; /* out of memory: lookups just miss */
+    }
+    slot = s->lw_pid & (snake_index_size - 1);
+    s->tid_next = snake_index[slot];
+    snake_index[slot] = s;
+    snake_index_cnt++;
+}
+
+/*
+ * Description: takes a snake out of the lw_pid table if it is there
+ * Params: snake s
+ * Return: void
+ */
+static void index_remove(snake s)
+{
+    snake *link;
+
+    if (snake_index_size == 0)
+    {
+        return;
+    }
+    for (link = &snake_index[s->lw_pid & (snake_index_size - 1)]; *link != NULL; link = &(*link)->tid_next)
+    {
+        if (*link == s)
+        {
+            *link = s->tid_next;
+            snake_index_cnt--;
+            return;
+        }
+    }
+}
+
+/*
+ * Description: sleeps for the snake delay
+ * Params: void
+ * Return: void
+ */
+static void delay(void)
+{
+    struct timespec ts;
+
+    ts.tv_sec = snake_delay / 1000;
+    ts.tv_nsec = (snake_delay % 1000) * 1000000L;
+    if (nanosleep(&ts, NULL) == -1 && errno != EINTR)
+    {
+        perror("nanosleep");
+    }
+}
+
+/*
+ * Description: moves a snake one step, heading dir if that cell is free
+ * and otherwise trying the other directions from a random one; a boxed in
+ * snake stays put and its tail catches up. Updates the grid and redraws
+ * only the old tail, the old head and the new head.
+ * Params: snake s and preferred direction
+ * Return: void
+ */
+static void step_snake(snake s, direction dir)
+{
+    sn_point head = s->body[0], tail = s->body[s->len - 1], to;
+    int i, d = dir;
+
+    to.x = head.x + board_dx[d];
+    to.y = head.y + board_dy[d];
+    if (obstructed(to))
+    {
+        d = random() % NUMDIRS;
+        for (i = 0; i < NUMDIRS; i++, d = (d + 1) % NUMDIRS)
+        {
+            to.x = head.x + board_dx[d];
+            to.y = head.y + board_dy[d];
+            if (!obstructed(to))
+            {
+                break;
+            }
+        }
+        if (i == NUMDIRS)
+        {
+            to = head;
+            d = s->dir;
+        }
+    }
+    s->dir = d;
+
+    occupy(to, 1);
+    memmove(s->body + 1, s->body, (s->len - 1) * sizeof(sn_point));
+    s->body[0] = to;
+    if (occupy(tail, -1) == 0)
+    {
+        mvaddch(tail.y, tail.x, ' ');
+    }
+    if (s->len > 1)
+    {
+        draw_segment(s, 1);
+    }
+    draw_segment(s, 0);
+}
+
+/*
+ * Description: puts the food on a random free cell. With every cell under
+ * a snake there is nowhere to put it, so there is no food until a cell
+ * frees up.
+ * Params: void
+ * Return: TRUE if the food was placed
+ */
+static int place_food(void)
+{
+    if (occupied >= (size_t)rows * cols)
+    {
+        food.x = -1;
+        food.y = -1;
+        return FALSE;
+    }
+    do
+    {
+        food.x = rand() % cols;
+        food.y = rand() % rows;
+    } while (obstructed(food));
+    return TRUE;
+}
+
+/*
+ * Description: draws the food
+ * Params: void
+ * Return: void
+ */
+static void draw_food(void)
+{
+    chtype c = SNAKE_FOOD_CHAR;
+
+    if (colored)
+    {
+        c |= COLOR_PAIR(SNAKE_FOOD_COLOR);
+    }
+    mvaddch(food.y, food.x, c);
+}
+
+/*
+ * Description: erases a snake from the screen
+ * Params: snake s
+ * Return: void
+ */
+static void erase_snake(snake s)
+{
+    int i;
+
+    for (i = 0; i < s->len; i++)
+    {
+        mvaddch(s->body[i].y, s->body[i].x, ' ');
+    }
+}
+
+/*
+ * Description: draws a whole snake
+ * Params: snake s
+ * Return: void
+ */
+static void draw_snake(snake s)
+{
+    int i;
+
+    for (i = s->len - 1; i >= 0; i--)
+    {
+        draw_segment(s, i);
+    }
+}
+
+/*
+ * Description: dies if kill_snake() has been called since the last check
+ * Params: snake s
+ * Return: void (doesn't return if s died)
+ */
+static void check_killed(snake s)
+{
+    if (endsnake)
+    {
+        endsnake = FALSE;
+        erase_snake(s);
+        free_snake(s);
+        render_flush();
+        lwp_exit(0);
+    }
+}
+
+/******************** Main Functions *******************/
+/*
+ * Description: starts curses and sizes the occupancy grid to the screen
+ * Params: void
+ * Return: 0 on success, 1 on failure
+ */
+int start_windowing(void)
+{
+    if (initscr() == NULL)
+    {
+        perror("initscr");
+        return 1;
+    }
+    colored = has_colors();
+    if (colored)
+    {
+        start_color();
+        init_pair(1, COLOR_BLUE, COLOR_BLACK);
+        init_pair(2, COLOR_RED, COLOR_BLACK);
+        init_pair(3, COLOR_GREEN, COLOR_BLACK);
+        init_pair(4, COLOR_MAGENTA, COLOR_BLACK);
+        init_pair(5, COLOR_CYAN, COLOR_BLACK);
+        init_pair(6, COLOR_YELLOW, COLOR_BLACK);
+        init_pair(7, COLOR_WHITE, COLOR_BLACK);
+        init_pair(8, COLOR_BLACK, COLOR_BLACK);
+    }
+    noecho();
+    cbreak();
+    timeout(0);
+    rows = LINES;
+    cols = COLS;
+    if (board_init(&grid, rows, cols) < 0)
+    {
+        endwin();
+        return 1;
+    }
+    occupied = 0;
+    srand(getpid());
+    clear();
+    curs_set(0);
+    refresh();
+    return 0;
+}
+
+/*
+ * Description: shuts curses down
+ * Params: void
+ * Return: void
+ */
+void end_windowing(void)
+{
+    endwin();
+}
+
+/*
+ * Description: makes a snake with its head at (y, x) and its body trailing
+ * back against dir, clamped to the screen
+ * Params: head row and column, length, direction and color pair
+ * Return: the snake, or NULL if out of memory
+ */
+snake new_snake(int y, int x, int len, int dir, int color)
+{
+    snake s;
+    int i;
+
+    s = malloc(sizeof(*s));
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    s->body = malloc(len * sizeof(sn_point));
+    if (s->body == NULL)
+    {
+        free(s);
+        return NULL;
+    }
+    s->dir = dir;
+    s->len = len;
+    s->color = color;
+    s->lw_pid = NO_THREAD;
+    s->tid_next = NULL;
+
+    y = clamp(y, rows);
+    x = clamp(x, cols);
+    for (i = 0; i < len; i++)
+    {
+        s->body[i].x = x;
+        s->body[i].y = y;
+        occupy(s->body[i], 1);
+        x = clamp(x - board_dx[dir], cols);
+        y = clamp(y - board_dy[dir], rows);
+    }
+
+    s->others = allsnakes;
+    allsnakes = s;
+    return s;
+}
+
+/*
+ * Description: unlinks a snake, takes it off the grid and frees it
+ * Params: snake s
+ * Return: void
+ */
+void free_snake(snake s)
+{
+    snake *link;
+    int i;
+
+    for (link = &allsnakes; *link != NULL; link = &(*link)->others)
+    {
+        if (*link == s)
+        {
+            *link = s->others;
+            break;
+        }
+    }
+    for (i = 0; i < s->len; i++)
+    {
+        occupy(s->body[i], -1);
+    }
+    index_remove(s);
+    free(s->body);
+    free(s);
+}
+
+/*
+ * Description: draws every snake
+ * Params: void
+ * Return: void
+ */
+void draw_all_snakes(void)
+{
+    snake s;
+
+    for (s = allsnakes; s != NULL; s = s->others)
+    {
+        draw_snake(s);
+    }
+    refresh();
+}
+
+/*
+ * Description: LWP body for a snake that wanders at random, going
+ * straight until something is in the way
+ * Params: snake *sp
+ * Return: doesn't (exits when killed)
+ */
+void run_snake(snake *sp)
+{
+    snake s = *sp;
+
+    index_add(s);
+    for (;;)
+    {
+        delay();
+        step_snake(s, s->dir);
+        render_tick();
+        check_killed(s);
+        lwp_yield();
+    }
+}
+
+/*
+ * Description: LWP body for a snake that heads for the food. Each meal
+ * moves the food and bumps the snake's color; a snake that eats past the
+ * last visible color is done.
+ * Params: snake *sp
+ * Return: doesn't (exits when full or killed)
+ */
+void run_hungry_snake(snake *sp)
+{
+    snake s = *sp;
+    int dx, dy;
+
+    index_add(s);
+    for (;;)
+    {
+        if (food.x == -1 && place_food())
+        {
+            draw_food();
+        }
+        delay();
+        if (food.x == -1)
+        {
+            step_snake(s, s->dir); /* no food: carry on */
+        }
+        else
+        {
+            dx = (food.x > s->body[0].x) - (food.x < s->body[0].x);
+            dy = (food.y > s->body[0].y) - (food.y < s->body[0].y);
+            step_snake(s, toward[(dy + 1) * 3 + dx + 1]);
+        }
+        if (s->body[0].x == food.x && s->body[0].y == food.y)
+        {
+            if (place_food())
+            {
+                draw_food();
+            }
+            s->color++;
+            if (s->color > MAX_VISIBLE_SNAKE)
+            {
+                erase_snake(s);
+                free_snake(s);
+                render_flush();
+                lwp_exit(0);
+            }
+            draw_snake(s);
+        }
+        render_tick();
+        check_killed(s);
+        lwp_yield();
+    }
+}
+
+/*
+ * Description: marks a snake for death; the next one to move takes it.
+ * Only sets a flag, so it is safe from a signal handler.
+ * Params: void
+ * Return: void
+ */
+void kill_snake(void)
+{
+    endsnake = TRUE;
+}
+
+/*
+ * Description: reads the delay between moves
+ * Params: void
+ * Return: milliseconds
+ */
+unsigned int get_snake_delay(void)
+{
+    return snake_delay;
+}
+
+/*
+ * Description: sets the delay between moves
+ * Params: milliseconds
+ * Return: void
+ */
+void set_snake_delay(unsigned int msec)
+{
+    snake_delay = msec;
+}
+
+/*
+ * Description: finds the snake an LWP is running, through the lw_pid table.
+ * Snakes are in it from the time their LWP first runs.
+ * Params: tid_t lw_pid
+ * Return: the snake, or NULL if none has that lw_pid
+ */
+snake snakeFromLWpid(tid_t lw_pid)
+{
+    snake s;
+
+    if (snake_index_size == 0)
+    {
+        return NULL;
+    }
+    for (s = snake_index[lw_pid & (snake_index_size - 1)]; s != NULL; s = s->tid_next)
+    {
+        if (s->lw_pid == lw_pid)
+        {
+            return s;
+        }
+    }
+    return NULL;
+}
@@ -17,6 +17,7 @@ typedef struct snake_st {
   sn_point        *body;
   tid_t           lw_pid;       /* useful for playing with scheduling */
   struct snake_st *others;      /* a utility link to find all snakes again */
+  struct snake_st *tid_next;    /* chain in the lw_pid table */
 } *snake;
 
 /* Colors range from 1 (blue on black) to 8 ( black on black).
@@ -0,0 +1,316 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <ncurses.h>
+#include "lwp.h"
+#include "lwpsleep.h"
+#include "metrics.h"
+#include "snakeboard.h"
+#include "snakerender.h"
+#include "tsc.h"
+
+/*
+ * Summary: headless snake simulation. Every snake is an LWP wandering an
+ * in-memory board the way run_snake() does on screen, but nothing is
+ * drawn, so the run measures the runtime instead of the terminal. With
+ * the default delay of 0 a snake yields after every move, which makes
+ * this a many-LWP context-switch benchmark with a little real work (and
+ * real cache misses on the board) between switches. -v shows the board
+ * (as much as fits the terminal) through the dirty-region renderer, one
+ * refresh every -f milliseconds however many snakes moved.
+ *
+ * usage: snakesim [-n snakes] [-r rows] [-c cols] [-l length]
+ *                 [-d delay_ms] [-t seconds] [-S stacksize] [-v] [-f ms]
+ */
+
+#define SIM_DEFAULT_SNAKES 10000
+#define SIM_DEFAULT_LEN 10
+#define SIM_TURN_ODDS 8  /* a snake turns on its own once in this many moves */
+
+typedef struct sim_snake
+{
+    uint32_t id;    /* owner id on the board */
+    direction dir;
+    int len;
+    int head;       /* body is a ring; body[head] is the head, */
+    sn_point *body; /* body[(head + 1) % len] the tail        */
+    uint64_t rng;
+} sim_snake;
+
+static board sim_board;
+static int stopping = FALSE;
+static long delay_ms = 0;
+static unsigned long moves = 0;
+static unsigned long stuck = 0; /* moves lost to being boxed in */
+
+/******************** Support Functions *******************/
+/*
+ * Description: xorshift64 step
+ * Params: state
+ * Return: random 64 bits
+ */
+static uint64_t rand64(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/*
+ * Description: moves a snake one cell in direction d if the cell is free:
+ * the tail cell is released and reused as the new head
+ * Params: snake and direction
+ * Return: TRUE if it moved
+ */
+static int try_move(sim_snake *s, direction d)
+{
+    sn_point *h = &s->body[s->head];
+    int y = h->y + board_dy[d], x = h->x + board_dx[d];
+    int tail = s->head + 1 == s->len ? 0 : s->head + 1;
+
+    if (board_get(&sim_board, y, x) != BOARD_EMPTY)
+    {
+        return FALSE;
+    }
+    board_set(&sim_board, s->body[tail].y, s->body[tail].x, BOARD_EMPTY);
+    board_set(&sim_board, y, x, s->id);
+    s->body[tail].y = y;
+    s->body[tail].x = x;
+    s->head = tail;
+    s->dir = d;
+    return TRUE;
+}
+
+/*
+ * Description: one step of a random snake: sometimes turn, and when
+ * blocked try the other directions starting from a random one
+ * Params: snake
+ * Return: void
+ */
+static void step(sim_snake *s)
+{
+    uint64_t r = rand64(&s->rng);
+    int i, d;
+
+    if (r % SIM_TURN_ODDS != 0 && try_move(s, s->dir))
+    {
+        moves++;
+        return;
+    }
+    d = (r >> 8) % NUMDIRS;
+    for (i = 0; i < NUMDIRS; i++, d = (d + 1) % NUMDIRS)
+    {
+        if (try_move(s, d))
+        {
+            moves++;
+            return;
+        }
+    }
+    stuck++;
+}
+
+/*
+ * Description: color pair of a snake on screen
+ * Params: owner id
+ * Return: pair 1..MAX_VISIBLE_SNAKE
+ */
+static int sim_color(uint32_t owner)
+{
+    return owner % MAX_VISIBLE_SNAKE + 1;
+}
+
+/*
+ * Description: starts curses with one color pair per visible snake color
+ * Params: void
+ * Return: void
+ */
+static void sim_windowing(void)
+{
+    int i;
+
+    initscr();
+    cbreak();
+    noecho();
+    curs_set(0);
+    start_color();
+    for (i = 1; i <= MAX_VISIBLE_SNAKE; i++)
+    {
+        init_pair(i, i, COLOR_BLACK);
+    }
+}
+
+/*
+ * Description: snake LWP body, moves until main says stop
+ * Params: sim_snake *
+ * Return: 0
+ */
+static int run_sim_snake(void *arg)
+{
+    sim_snake *s = arg;
+
+    while (!stopping)
+    {
+        step(s);
+        if (delay_ms > 0)
+        {
+            lwp_sleep_ns(delay_ms * 1000000ull);
+        }
+        else
+        {
+            lwp_yield();
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long n = SIM_DEFAULT_SNAKES, i;
+    int rows = 0, cols = 0, len = SIM_DEFAULT_LEN, per_row, k, opt;
+    int visual = FALSE, tick_ms = 0;
+    render_stats rs;
+    double secs = 5, start, elapsed, deadline;
+    unsigned long switches, done;
+    lwp_attr attr = {0, FALSE, 0};
+    sim_snake *snakes;
+    sn_point *bodies;
+
+    while ((opt = getopt(argc, argv, "n:r:c:l:d:t:S:vf:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            n = atol(optarg);
+            break;
+        case 'r':
+            rows = atoi(optarg);
+            break;
+        case 'c':
+            cols = atoi(optarg);
+            break;
+        case 'l':
+            len = atoi(optarg);
+            break;
+        case 'd':
+            delay_ms = atol(optarg);
+            break;
+        case 't':
+            secs = atof(optarg);
+            break;
+        case 'S':
+            attr.stacksize = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            visual = TRUE;
+            break;
+        case 'f':
+            tick_ms = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n snakes] [-r rows] [-c cols] [-l length] "
+                            "[-d delay_ms] [-t seconds] [-S stacksize] [-v] [-f ms]\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (n <= 0 || len < 2)
+    {
+        fprintf(stderr, "%s: need at least one snake of length 2 or more\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* default: a square board about a quarter full */
+    if (rows <= 0 || cols <= 0)
+    {
+        rows = cols = (int)ceil(sqrt(4.0 * n * (len + 1)));
+    }
+    per_row = cols / (len + 1);
+    if (per_row == 0 || (long)per_row * ((rows + 1) / 2) < n)
+    {
+        fprintf(stderr, "%s: %ld snakes of length %d don't fit on %dx%d\n", argv[0], n, len, rows, cols);
+        exit(EXIT_FAILURE);
+    }
+
+    if (board_init(&sim_board, rows, cols) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    snakes = calloc(n, sizeof(sim_snake));
+    bodies = malloc((size_t)n * len * sizeof(sn_point));
+    if (snakes == NULL || bodies == NULL)
+    {
+        perror(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* lay the snakes out heading east on every other row */
+    for (i = 0; i < n; i++)
+    {
+        snakes[i].id = i + 1;
+        snakes[i].dir = E;
+        snakes[i].len = len;
+        snakes[i].head = len - 1;
+        snakes[i].body = bodies + (size_t)i * len;
+        snakes[i].rng = 0x9E3779B97F4A7C15ull * (i + 1);
+        for (k = 0; k < len; k++)
+        {
+            snakes[i].body[k].y = (i / per_row) * 2;
+            snakes[i].body[k].x = (i % per_row) * (len + 1) + k;
+            board_set(&sim_board, snakes[i].body[k].y, snakes[i].body[k].x, snakes[i].id);
+        }
+    }
+
+    lwp_start();
+    if (visual)
+    {
+        sim_windowing();
+        render_init(&sim_board, sim_color);
+        render_start(tick_ms);
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (lwp_create_ex(run_sim_snake, &snakes[i], &attr) == (tid_t)-1)
+        {
+            fprintf(stderr, "%s: lwp_create failed after %ld snakes (try -S)\n", argv[0], i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* main only watches the clock, asleep until the run is over */
+    start = now_ns();
+    switches = lwp_mx->switches;
+    deadline = start + secs * 1e9;
+    lwp_sleep_until(deadline);
+    stopping = TRUE;
+    elapsed = (now_ns() - start) / 1e9;
+    switches = lwp_mx->switches - switches;
+    done = moves;
+
+    if (visual)
+    {
+        render_stop();
+        render_get_stats(&rs);
+        render_free();
+        endwin();
+        printf("snakesim: %lu frames, %.0f cells drawn per frame, %lu off screen\n", rs.ticks,
+               (double)rs.cells / (rs.ticks ? rs.ticks : 1), rs.skipped);
+    }
+    for (i = 0; i < n; i++)
+    {
+        lwp_wait(NULL);
+    }
+
+    printf("snakesim: %ld snakes on %dx%d, %.2fs: %lu moves (%.0f/s, %.1f ns each), "
+           "%lu stuck, %.0f switches/s\n",
+           n, rows, cols, elapsed, done, done / elapsed, elapsed * 1e9 / (done ? done : 1),
+           stuck, switches / elapsed);
+
+    board_free(&sim_board);
+    free(bodies);
+    free(snakes);
+    return 0;
+}
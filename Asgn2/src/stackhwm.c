@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include "stackhwm.h"
+#include "lwpsym.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Summary: measures how deep LWP stacks really get. Stacks are anonymous
+ * mappings, so a page is resident only if the thread touched it; mincore()
+ * on the mapping finds the lowest touched page without pre-filling 8MB of
+ * canary per thread. lwp.c drops a pooled stack's pages before reuse while
+ * checking is on, so every measurement starts clean.
+ */
+
+int lwp_stackcheck_on = FALSE;
+
+static stackhwm_entry table[STACKHWM_FUNCS];
+static int table_cnt = 0;
+static int atexit_done = FALSE;
+
+/*
+ * Description: prints the report to stderr when checking was turned on
+ * from the environment
+ * Params: void
+ * Return: void
+ */
+static void report_at_exit(void)
+{
+    lwp_stack_report(stderr);
+}
+
+/*
+ * Description: finds the table slot for an entry function
+ * Params: lwpfun fun and whether to add it if missing
+ * Return: entry, or NULL if missing (or the table is full)
+ */
+static stackhwm_entry *lookup(lwpfun fun, int add)
+{
+    unsigned int i = ((unsigned long)fun >> 4) % STACKHWM_FUNCS;
+    int probes;
+
+    for (probes = 0; probes < STACKHWM_FUNCS; probes++)
+    {
+        if (table[i].fun == fun)
+        {
+            return &table[i];
+        }
+        if (table[i].fun == NULL)
+        {
+            if (!add)
+            {
+                return NULL;
+            }
+            table[i].fun = fun;
+            table_cnt++;
+            return &table[i];
+        }
+        i = (i + 1) % STACKHWM_FUNCS;
+    }
+    return NULL;
+}
+
+/*
+ * Description: turns stack measurement on or off. LWP_STACKCHECK=1 at
+ * lwp_start() turns it on and prints the report at exit.
+ * Params: int on
+ * Return: void
+ */
+void lwp_stackcheck_enable(int on)
+{
+    lwp_stackcheck_on = on;
+    if (on && getenv("LWP_STACKCHECK") != NULL && !atexit_done)
+    {
+        atexit(report_at_exit);
+        atexit_done = TRUE;
+    }
+}
+
+/*
+ * Description: bytes of a stack in use, from the top of the mapping down to
+ * the lowest page ever touched
+ * Params: base and size of the stack mapping
+ * Return: size_t bytes used (page granularity)
+ */
+size_t stack_measure(unsigned long *stack, size_t stacksize)
+{
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    size_t pages = stacksize / page_size;
+    unsigned char *vec;
+    size_t i;
+
+    vec = malloc(pages);
+    if (vec == NULL || mincore(stack, stacksize, vec) == -1)
+    {
+        free(vec);
+        return 0;
+    }
+    for (i = 0; i < pages && !(vec[i] & 1); i++)
+        ;
+    free(vec);
+    return (pages - i) * page_size;
+}
+
+/*
+ * Description: folds one measurement into its entry function's summary
+ * Params: entry function, bytes used and reserved stack size
+ * Return: void
+ */
+void stack_record(lwpfun fun, size_t used, size_t stacksize)
+{
+    stackhwm_entry *e = lookup(fun, TRUE);
+
+    if (e == NULL)
+    {
+        return;
+    }
+    e->count++;
+    e->total_used += used;
+    e->stacksize = stacksize;
+    if (used > e->max_used)
+    {
+        e->max_used = used;
+    }
+}
+
+/*
+ * Description: stack size worth passing to lwp_create_ex() for threads
+ * running fun: the deepest use seen times STACKHWM_HEADROOM, in whole pages
+ * Params: lwpfun fun
+ * Return: size_t bytes, 0 if fun has not been measured
+ */
+size_t lwp_stack_advise(lwpfun fun)
+{
+    stackhwm_entry *e = lookup(fun, FALSE);
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    size_t size;
+
+    if (e == NULL || e->count == 0)
+    {
+        return 0;
+    }
+    size = e->max_used * STACKHWM_HEADROOM;
+    if (size < STACKHWM_MIN)
+    {
+        size = STACKHWM_MIN;
+    }
+    return ((size + page_size - 1) / page_size) * page_size;
+}
+
+/*
+ * Description: prints one line per entry function with its measured use
+ * and recommended stack size
+ * Params: FILE *out
+ * Return: void
+ */
+void lwp_stack_report(FILE *out)
+{
+    const char *name;
+    int i;
+
+    fprintf(out, "%-24s %10s %10s %10s %10s %10s\n", "entry", "threads",
+            "max", "avg", "reserved", "advise");
+    for (i = 0; i < STACKHWM_FUNCS; i++)
+    {
+        if (table[i].fun == NULL || table[i].count == 0)
+        {
+            continue;
+        }
+        name = lwp_symname((void *)table[i].fun, NULL);
+        if (name != NULL)
+        {
+            fprintf(out, "%-24s", name);
+        }
+        else
+        {
+            fprintf(out, "%-24p", (void *)table[i].fun);
+        }
+        fprintf(out, " %10lu %10zu %10zu %10zu %10zu\n", table[i].count,
+                table[i].max_used, table[i].total_used / table[i].count,
+                table[i].stacksize, lwp_stack_advise(table[i].fun));
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef STACKHWMH
+#define STACKHWMH
+#include <stdio.h>
+#include "lwp.h"
+
+/* stack high-water marks: with checking on, every thread's deepest stack
+ * use is measured at lwp_exit() (from the pages of its stack mapping that
+ * were ever touched) and summarized per entry function */
+
+#define STACKHWM_FUNCS 256   /* distinct entry functions tracked       */
+#define STACKHWM_HEADROOM 2  /* recommended size = headroom * max used */
+#define STACKHWM_MIN (16 * 1024)
+
+typedef struct stackhwm_entry
+{
+  lwpfun fun;          /* entry function passed to lwp_create  */
+  unsigned long count; /* threads measured                     */
+  size_t max_used;     /* deepest use seen, bytes              */
+  size_t total_used;   /* for the average                      */
+  size_t stacksize;    /* reserved size of the last one        */
+} stackhwm_entry;
+
+extern int lwp_stackcheck_on;
+extern void lwp_stackcheck_enable(int on);
+extern size_t lwp_stack_advise(lwpfun fun);
+extern void lwp_stack_report(FILE *out);
+
+/* hooks for lwp.c */
+extern size_t stack_measure(unsigned long *stack, size_t stacksize);
+extern void stack_record(lwpfun fun, size_t used, size_t stacksize);
+
+#endif
@@ -0,0 +1,110 @@
+#include "trace.h"
+#include "tsc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Summary: records scheduling events with TSC timestamps. There is one
+ * ring buffer because all LWPs run on one kernel thread, so recording needs
+ * no locks or atomics: an event is a store and an index bump. A full ring is
+ * written to the trace file and reused.
+ */
+
+int lwp_trace_on = FALSE;
+
+static trace_event ring[TRACE_RING_SIZE];
+static unsigned int ring_len = 0;
+static FILE *trace_file = NULL;
+static int atexit_done = FALSE;
+
+/*
+ * Description: adds one event to the ring, flushing it first if it is full
+ * Params: event type, aux, tid and argument
+ * Return: void
+ */
+void trace_record(uint32_t type, uint32_t aux, uint64_t tid, uint64_t arg)
+{
+    trace_event *ev;
+
+    if (ring_len == TRACE_RING_SIZE)
+    {
+        lwp_trace_flush();
+    }
+    ev = &ring[ring_len++];
+    ev->tsc = tsc_now();
+    ev->type = type;
+    ev->aux = aux;
+    ev->tid = tid;
+    ev->arg = arg;
+}
+
+/*
+ * Description: writes the buffered events to the trace file
+ * Params: void
+ * Return: void
+ */
+void lwp_trace_flush(void)
+{
+    if (trace_file != NULL && ring_len > 0)
+    {
+        if (fwrite(ring, sizeof(trace_event), ring_len, trace_file) != ring_len)
+        {
+            perror("lwp_trace_flush");
+        }
+    }
+    ring_len = 0;
+}
+
+/*
+ * Description: starts tracing into a new file. Tracing is stopped (and
+ * flushed) automatically at exit.
+ * Params: path of the trace file
+ * Return: 0 on success, -1 if the file can't be written
+ */
+int lwp_trace_start(const char *path)
+{
+    trace_header hdr;
+
+    lwp_trace_stop();
+
+    trace_file = fopen(path, "wb");
+    if (trace_file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.event_size = sizeof(trace_event);
+    hdr.tsc_per_ns = tsc_per_ns();
+    hdr.tsc_start = tsc_now();
+    fwrite(&hdr, sizeof(hdr), 1, trace_file);
+
+    if (!atexit_done)
+    {
+        atexit(lwp_trace_stop);
+        atexit_done = TRUE;
+    }
+    ring_len = 0;
+    lwp_trace_on = TRUE;
+    return 0;
+}
+
+/*
+ * Description: stops tracing and closes the trace file
+ * Params: void
+ * Return: void
+ */
+void lwp_trace_stop(void)
+{
+    lwp_trace_on = FALSE;
+    if (trace_file != NULL)
+    {
+        lwp_trace_flush();
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef TRACEH
+#define TRACEH
+#include <stdint.h>
+#include "lwp.h"
+
+/* scheduling event tracer: events go into a ring buffer that is flushed to
+ * a binary file; trace2json turns the file into Chrome/Perfetto JSON */
+
+#define TRACE_RING_SIZE (1 << 16) /* events buffered between flushes */
+#define TRACE_MAGIC "LWPTRACE"
+#define TRACE_VERSION 1
+
+/* event types */
+#define TRACE_SWITCH 1 /* tid switched in, arg = tid out, aux = LWP_SWITCH_* */
+#define TRACE_CREATE 2 /* tid created, arg = creator                        */
+#define TRACE_EXIT 3   /* tid exited, arg = exit status                      */
+#define TRACE_WAIT 4   /* tid reaped arg in wait/join                        */
+#define TRACE_WAKE 5   /* tid made runnable, arg = waker                     */
+#define TRACE_BLOCK 6  /* tid parked, aux = LWP_BLOCK_*                      */
+
+typedef struct trace_event
+{
+  uint64_t tsc;
+  uint32_t type;
+  uint32_t aux;
+  uint64_t tid;
+  uint64_t arg;
+} trace_event;
+
+/* file header, followed by trace_events until EOF */
+typedef struct trace_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t event_size;
+  double tsc_per_ns;
+  uint64_t tsc_start;
+} trace_header;
+
+extern int lwp_trace_start(const char *path);
+extern void lwp_trace_stop(void);
+extern void lwp_trace_flush(void);
+
+/* recording hook; compile with -DLWP_NO_TRACE to remove it entirely */
+extern int lwp_trace_on;
+extern void trace_record(uint32_t type, uint32_t aux, uint64_t tid, uint64_t arg);
+
+#ifdef LWP_NO_TRACE
+#define TRACE(type, aux, tid, arg) ((void)0)
+#else
+#define TRACE(type, aux, tid, arg)             \
+  do                                           \
+  {                                            \
+    if (lwp_trace_on)                          \
+      trace_record((type), (aux), (tid), (arg)); \
+  } while (0)
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+/*
+ * Summary: converts a binary LWP trace into Chrome trace JSON (load it in
+ * ui.perfetto.dev or chrome://tracing). Every LWP shows up as a thread with
+ * a "run" slice per time slice, plus instant events for create, exit, wait,
+ * wake and block.
+ *
+ * usage: trace2json trace.bin > trace.json
+ */
+
+static const char *event_names[] = {
+    "?", "switch", "create", "exit", "wait", "wake", "block"};
+
+static const char *switch_names[] = {"yield", "block", "exit"};
+
+static unsigned char *named = NULL; /* bitmap of tids already given a name */
+static uint64_t named_bits = 0;
+static int first = TRUE;
+
+/*
+ * Description: prints the separator before every event but the first
+ * Params: FILE *out
+ * Return: void
+ */
+static void sep(FILE *out)
+{
+    fputs(first ? "\n" : ",\n", out);
+    first = FALSE;
+}
+
+/*
+ * Description: emits a thread_name record the first time a tid shows up
+ * Params: FILE *out and tid
+ * Return: void
+ */
+static void name_thread(FILE *out, uint64_t tid)
+{
+    uint64_t bits;
+
+    if (tid >= named_bits)
+    {
+        bits = named_bits ? named_bits : 1024;
+        while (bits <= tid)
+        {
+            bits *= 2;
+        }
+        named = realloc(named, bits / 8);
+        if (named == NULL)
+        {
+            perror("trace2json");
+            exit(EXIT_FAILURE);
+        }
+        memset(named + named_bits / 8, 0, (bits - named_bits) / 8);
+        named_bits = bits;
+    }
+    if (named[tid / 8] & (1 << (tid % 8)))
+    {
+        return;
+    }
+    named[tid / 8] |= 1 << (tid % 8);
+
+    sep(out);
+    fprintf(out, "{\"ph\":\"M\",\"pid\":1,\"tid\":%llu,\"name\":\"thread_name\","
+                 "\"args\":{\"name\":\"%s %llu\"}}",
+            (unsigned long long)tid, tid ? "lwp" : "main", (unsigned long long)tid);
+}
+
+int main(int argc, char *argv[])
+{
+    trace_header hdr;
+    trace_event ev;
+    FILE *in, *out = stdout;
+    double us;
+    int64_t running = -1;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s trace.bin > trace.json\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != TRACE_VERSION || hdr.event_size != sizeof(trace_event))
+    {
+        fprintf(stderr, "%s: not a version %d LWP trace\n", argv[1], TRACE_VERSION);
+        exit(EXIT_FAILURE);
+    }
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+    while (fread(&ev, sizeof(ev), 1, in) == 1)
+    {
+        us = (double)(ev.tsc - hdr.tsc_start) / hdr.tsc_per_ns / 1000.0;
+        name_thread(out, ev.tid);
+
+        if (ev.type == TRACE_SWITCH)
+        {
+            /* close the outgoing slice, open the incoming one */
+            if (running >= 0)
+            {
+                sep(out);
+                fprintf(out, "{\"ph\":\"E\",\"pid\":1,\"tid\":%lld,\"ts\":%.3f,"
+                             "\"args\":{\"why\":\"%s\"}}",
+                        (long long)running, us, ev.aux < 3 ? switch_names[ev.aux] : "?");
+            }
+            sep(out);
+            fprintf(out, "{\"ph\":\"B\",\"pid\":1,\"tid\":%llu,\"ts\":%.3f,\"name\":\"run\"}",
+                    (unsigned long long)ev.tid, us);
+            running = ev.tid;
+        }
+        else
+        {
+            sep(out);
+            fprintf(out, "{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%llu,\"ts\":%.3f,"
+                         "\"name\":\"%s\",\"args\":{\"arg\":%llu}}",
+                    (unsigned long long)ev.tid, us,
+                    ev.type <= TRACE_BLOCK ? event_names[ev.type] : "?", (unsigned long long)ev.arg);
+        }
+    }
+    fputs("\n]}\n", out);
+
+    fclose(in);
+    free(named);
+    return 0;
+}
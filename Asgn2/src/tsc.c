@@ -0,0 +1,44 @@
+#include "tsc.h"
+#include <time.h>
+
+/*
+ * Summary: converts TSC cycles to wall time. The rate is measured once
+ * against CLOCK_MONOTONIC over TSC_CALIBRATE_NS and cached.
+ */
+
+#define TSC_CALIBRATE_NS 10000000 /* 10ms */
+
+static double rate = 0;
+
+/*
+ * Description: TSC cycles per nanosecond
+ * Params: void
+ * Return: double rate
+ */
+double tsc_per_ns(void)
+{
+    uint64_t ns0, ns1, c0, c1;
+
+    if (rate == 0)
+    {
+        ns0 = now_ns();
+        c0 = tsc_now();
+        do
+        {
+            ns1 = now_ns();
+        } while (ns1 - ns0 < TSC_CALIBRATE_NS);
+        c1 = tsc_now();
+        rate = (double)(c1 - c0) / (ns1 - ns0);
+    }
+    return rate;
+}
+
+/*
+ * Description: converts a cycle count to nanoseconds
+ * Params: uint64_t cycles
+ * Return: uint64_t ns
+ */
+uint64_t tsc_to_ns(uint64_t cycles)
+{
+    return (uint64_t)(cycles / tsc_per_ns());
+}
@@ -0,0 +1,24 @@
+#ifndef TSCH
+#define TSCH
+#include <stdint.h>
+#include <time.h>
+#include <x86intrin.h>
+
+/* raw time stamp counter, cheap enough for the switch path */
+static inline uint64_t tsc_now(void)
+{
+  return __rdtsc();
+}
+
+/* monotonic clock in nanoseconds, for wall-time deadlines and reports */
+static inline uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+extern double tsc_per_ns(void);          /* calibrated on first call */
+extern uint64_t tsc_to_ns(uint64_t cycles);
+
+#endif
@@ -29,6 +29,7 @@
 #include <signal.h>
 // #include "snakes.h"
 #include "lwp.h"
+#include "dump.h"
 #include "util.h"
 
 #ifdef OLDSCHEDULERS
@@ -128,6 +129,7 @@ void SIGINT_handler(int num)
 
 void SIGQUIT_handler(int num)
 {
+  lwp_dump(stderr); /* show where every LWP is */
 }
 
 void install_handler(int sig, sigfun fun)